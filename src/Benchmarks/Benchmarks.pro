@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Benchmarks of the integration hot paths, run from the build directory:
+# ./Benchmarks [output.xml] [map resolution] [classification agreement for the integrator comparison]
+#
+#-------------------------------------------------
+
+QT       += core gui
+QT += xml
+TARGET = Benchmarks
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -std=c++1y
+QMAKE_CXXFLAGS += -pthread
+QMAKE_CXXFLAGS_RELEASE += -ffast-math
+# no -march=native, the batch mode step is compiled for SSE2, AVX2 and AVX-512 and picked at runtime, see cpu_dispatch.h
+QMAKE_CXXFLAGS_RELEASE += -funroll-loops
+# DEFINES += PENDULUM_INSTRUMENTATION # adds rejected steps and RHS evaluations to the step control results
+INCLUDEPATH += ..
+SOURCES += benchmark.cpp
+
+LIBS += -pthread
@@ -0,0 +1,470 @@
+#include "pendulum_map.h"
+#include "pendulum_system.h"
+#include "thread_pool.h"
+#include "Integrators/ck45.h"
+#include "Integrators/rk4.h"
+#include "Integrators/bs32.h"
+#include "Integrators/dopri54.h"
+#include "Integrators/dop853.h"
+#include "cpu_dispatch.h"
+#include <iostream>
+#include <vector>
+#include <array>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <QDomDocument>
+#include <QFile>
+#include <QString>
+
+// Benchmarks of the integration hot paths with fixed seeds and grids so results can be compared between builds.
+// Micro benchmarks repeat their kernel for at least min_run_time and report the fastest of run_count runs, the map benchmarks
+// integrate a full map once per thread count. The integrator comparison integrates the map with every adaptive integrator over a range
+// of tolerances and compares points/s at equal classification accuracy against a tight tolerance dop853 reference map.
+// Results are printed and written as xml attributes to the output file.
+
+typedef std::chrono::steady_clock clock_type;
+
+const double min_run_time = 0.2; // seconds per micro benchmark run
+const unsigned int run_count = 5;
+const unsigned int state_count = 1024;
+const unsigned int seed = 12345;
+const double reference_tolerance = 1e-10;
+const std::array<double, 5> tolerances = {{1e-3, 1e-4, 1e-5, 1e-6, 1e-7}};
+
+volatile double sink; // keeps the results of the kernels alive
+
+// start states spread over the map away from the pendulum length boundary, at rest like the map points
+std::vector<state_type> random_states(const pendulum_system &the_system)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> position(-0.8*the_system.L/std::sqrt(2.0), 0.8*the_system.L/std::sqrt(2.0));
+    std::vector<state_type> states(state_count);
+    for (auto &state : states) {
+        state = state_type{{position(generator), position(generator), 0.0, 0.0}};
+    }
+    return states;
+}
+
+// run kernel(), which returns the number of operations it performed, until min_run_time passed and return the fastest time per operation in ns
+template <typename kernel_type>
+double time_per_operation(kernel_type kernel)
+{
+    double best = 0.0;
+    for (unsigned int run = 0; run < run_count; run++) {
+        unsigned long long operations = 0;
+        const clock_type::time_point start = clock_type::now();
+        std::chrono::duration<double> elapsed(0.0);
+        while (elapsed.count() < min_run_time) {
+            operations += kernel();
+            elapsed = clock_type::now() - start;
+        }
+        const double ns = elapsed.count()*1e9/double(operations);
+        best = (run == 0) ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+QDomElement add_result(QDomDocument &document, QDomElement &root, const QString &name)
+{
+    QDomElement element = document.createElement("benchmark");
+    element.setAttribute("name", name);
+    root.appendChild(element);
+    return element;
+}
+
+// integrate the map at resolution in batch mode on the pool into the_map, returns the points per second
+template <typename integrator_type>
+double integrate_benchmark_map(const pendulum_system &the_system, const integrator_type &the_integrator, thread_pool &pool, double resolution, map_type &the_map)
+{
+    pendulum_map<integrator_type> mapper;
+    mapper.set_map(-10.0, 10.0, -10.0, 10.0, resolution);
+    mapper.set_thread_pool(&pool);
+    mapper.set_batch_mode(true);
+    the_map = mapper.create_map_container();
+    const clock_type::time_point start = clock_type::now();
+    mapper.parallel_integrate_map(the_system, the_integrator, the_map);
+    const std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return double(the_map.size())/elapsed.count();
+}
+
+// fraction of the points that converge to the same position in both maps
+double classification_agreement(const map_type &the_map, const map_type &reference_map)
+{
+    std::size_t agree_count = 0;
+    for (std::size_t i = 0; i < the_map.size(); i++) {
+        agree_count += (the_map[i].converge_position == reference_map[i].converge_position) ? 1 : 0;
+    }
+    return the_map.size() > 0 ? double(agree_count)/double(the_map.size()) : 1.0;
+}
+
+// integrate the map with integrator_type at every tolerance, writes the throughput and agreement with the reference map of each and
+// the fastest tolerance that reaches target_agreement
+template <typename integrator_type>
+void compare_integrator(QDomDocument &document, QDomElement &root, const pendulum_system &the_system, thread_pool &pool, double resolution, const map_type &reference_map, double target_agreement)
+{
+    double best_rate = 0.0;
+    double best_tolerance = 0.0;
+    double best_agreement = 0.0;
+    for (const double tolerance : tolerances) {
+        integrator_type the_integrator;
+        the_integrator.set_tolerance(tolerance, tolerance);
+        map_type the_map;
+        const double points_per_second = integrate_benchmark_map(the_system, the_integrator, pool, resolution, the_map);
+        const double agreement = classification_agreement(the_map, reference_map);
+        if (agreement >= target_agreement && points_per_second > best_rate) {
+            best_rate = points_per_second;
+            best_tolerance = tolerance;
+            best_agreement = agreement;
+        }
+
+        QDomElement element = add_result(document, root, "integrator_accuracy");
+        element.setAttribute("integrator", QString(integrator_type::name()));
+        element.setAttribute("tolerance", tolerance);
+        element.setAttribute("points_per_second", points_per_second);
+        element.setAttribute("agreement", agreement);
+        std::cout << integrator_type::name() << " at tolerance " << tolerance << ": " << points_per_second << " points/s, agreement " << agreement << '\n';
+    }
+
+    QDomElement element = add_result(document, root, "integrator_equal_accuracy");
+    element.setAttribute("integrator", QString(integrator_type::name()));
+    element.setAttribute("target_agreement", target_agreement);
+    if (best_rate > 0.0) {
+        element.setAttribute("tolerance", best_tolerance);
+        element.setAttribute("points_per_second", best_rate);
+        element.setAttribute("agreement", best_agreement);
+        std::cout << integrator_type::name() << " at " << target_agreement << " agreement: " << best_rate << " points/s at tolerance " << best_tolerance << '\n';
+    } else {
+        std::cout << integrator_type::name() << " does not reach " << target_agreement << " agreement\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const QString output_filename = argc > 1 ? QString(argv[1]) : QString("benchmark.xml");
+    const double resolution = argc > 2 ? std::atof(argv[2]) : 0.1;
+    const double target_agreement = argc > 3 ? std::atof(argv[3]) : 0.99;
+
+    pendulum_system the_system;
+    ck45 the_ck45;
+    rk4 the_rk4;
+    const std::vector<state_type> states = random_states(the_system);
+
+    QDomDocument document("Benchmarks");
+    QDomElement root = document.createElement("Benchmarks");
+    document.appendChild(root);
+    root.setAttribute("seed", seed);
+    root.setAttribute("hardware_threads", std::thread::hardware_concurrency());
+    root.setAttribute("attractor_count", (unsigned int)(the_system.attractor_list().size()));
+    root.setAttribute("cpu_isa", QString(cpu_isa_name(selected_cpu_isa())));
+    std::cout << "Integration kernels: " << cpu_isa_name(selected_cpu_isa()) << '\n';
+
+    // pendulum_system::operator() on single states and on batches of batch_lanes states
+    {
+        const double ns = time_per_operation([&]() {
+            state_type dxdt;
+            double sum = 0.0;
+            for (const auto &state : states) {
+                the_system(state, dxdt, 0.0);
+                sum += dxdt[2];
+            }
+            sink = sum;
+            return states.size();
+        });
+        add_result(document, root, "rhs").setAttribute("ns_per_eval", ns);
+        std::cout << "pendulum_system::operator(): " << ns << " ns/RHS eval\n";
+    }
+    {
+        std::vector<batch_state_type<batch_lanes>> batches(states.size()/batch_lanes);
+        for (std::size_t i = 0; i < states.size(); i++) {
+            for (std::size_t component = 0; component < 4; component++) {
+                batches[i/batch_lanes][component][i%batch_lanes] = states[i][component];
+            }
+        }
+        const std::array<double, batch_lanes> t{};
+        const double ns = time_per_operation([&]() {
+            batch_state_type<batch_lanes> dxdt;
+            double sum = 0.0;
+            for (const auto &batch : batches) {
+                the_system(batch, dxdt, t);
+                sum += dxdt[2][0];
+            }
+            sink = sum;
+            return batches.size()*batch_lanes;
+        });
+        add_result(document, root, "batch_rhs").setAttribute("ns_per_eval", ns);
+        std::cout << "pendulum_system::operator() batch: " << ns << " ns/RHS eval\n";
+    }
+
+    // the same evaluations with the fixed_pendulum_system dispatched on the attractor count, in double and in float (mixed precision)
+    auto time_step_system = [&](const auto &step_system, const QString &name) {
+        const double ns = time_per_operation([&]() {
+            state_type dxdt;
+            double sum = 0.0;
+            for (const auto &state : states) {
+                step_system(state, dxdt, 0.0);
+                sum += dxdt[2];
+            }
+            sink = sum;
+            return states.size();
+        });
+        add_result(document, root, name + "_rhs").setAttribute("ns_per_eval", ns);
+        std::cout << "fixed_pendulum_system::operator() " << name << ": " << ns << " ns/RHS eval\n";
+
+        std::vector<batch_state_type<batch_lanes>> batches(states.size()/batch_lanes);
+        for (std::size_t i = 0; i < states.size(); i++) {
+            for (std::size_t component = 0; component < 4; component++) {
+                batches[i/batch_lanes][component][i%batch_lanes] = states[i][component];
+            }
+        }
+        const std::array<double, batch_lanes> t{};
+        const double batch_ns = time_per_operation([&]() {
+            batch_state_type<batch_lanes> dxdt;
+            double sum = 0.0;
+            for (const auto &batch : batches) {
+                step_system(batch, dxdt, t);
+                sum += dxdt[2][0];
+            }
+            sink = sum;
+            return batches.size()*batch_lanes;
+        });
+        add_result(document, root, name + "_batch_rhs").setAttribute("ns_per_eval", batch_ns);
+        std::cout << "fixed_pendulum_system::operator() " << name << " batch: " << batch_ns << " ns/RHS eval\n";
+    };
+    dispatch_attractor_count<double>(the_system, [&](const auto &step_system) { time_step_system(step_system, "fixed"); });
+    dispatch_attractor_count<float>(the_system, [&](const auto &step_system) { time_step_system(step_system, "mixed"); });
+
+    // integrator steps from every state, steps of ck45 include rejected trials
+    const unsigned int steps_per_state = 64;
+    {
+        unsigned long long accepted = 0;
+        unsigned long long trials = 0;
+        const double ns = time_per_operation([&]() {
+            double sum = 0.0;
+            for (const auto &start_state : states) {
+                state_type x = start_state;
+                double t = 0.0;
+                double h = 0.001;
+                for (unsigned int step = 0; step < steps_per_state; step++) {
+                    accepted += the_ck45.do_step(the_system, x, t, h);
+                }
+                sum += x[0];
+            }
+            sink = sum;
+            trials += std::size_t(states.size())*steps_per_state;
+            return std::size_t(states.size())*steps_per_state;
+        });
+        QDomElement element = add_result(document, root, "ck45_do_step");
+        element.setAttribute("ns_per_step", ns);
+        element.setAttribute("steps_per_second", 1e9/ns);
+        element.setAttribute("accepted_fraction", double(accepted)/double(trials));
+        std::cout << "ck45::do_step: " << ns << " ns/step, " << 1e9/ns << " steps/s, accepted " << double(accepted)/double(trials) << '\n';
+    }
+    {
+        const double ns = time_per_operation([&]() {
+            double sum = 0.0;
+            for (const auto &start_state : states) {
+                state_type x = start_state;
+                double t = 0.0;
+                for (unsigned int step = 0; step < steps_per_state; step++) {
+                    the_rk4.do_step(the_system, x, t, 0.001);
+                }
+                sum += x[0];
+            }
+            sink = sum;
+            return std::size_t(states.size())*steps_per_state;
+        });
+        QDomElement element = add_result(document, root, "rk4_do_step");
+        element.setAttribute("ns_per_step", ns);
+        element.setAttribute("steps_per_second", 1e9/ns);
+        std::cout << "rk4::do_step: " << ns << " ns/step, " << 1e9/ns << " steps/s\n";
+    }
+    {
+        const double ns = time_per_operation([&]() {
+            double sum = 0.0;
+            for (std::size_t first = 0; first + batch_lanes <= states.size(); first += batch_lanes) {
+                batch_state_type<batch_lanes> x;
+                std::array<double, batch_lanes> t;
+                std::array<double, batch_lanes> h;
+                std::array<int, batch_lanes> accepted;
+                for (std::size_t lane = 0; lane < batch_lanes; lane++) {
+                    for (std::size_t component = 0; component < 4; component++) {
+                        x[component][lane] = states[first + lane][component];
+                    }
+                    t[lane] = 0.0;
+                    h[lane] = 0.001;
+                }
+                for (unsigned int step = 0; step < steps_per_state; step++) {
+                    the_ck45.do_batch_step(the_system, x, t, h, accepted);
+                }
+                sum += x[0][0];
+            }
+            sink = sum;
+            return std::size_t(states.size())*steps_per_state;
+        });
+        QDomElement element = add_result(document, root, "ck45_do_batch_step");
+        element.setAttribute("ns_per_step", ns);
+        element.setAttribute("steps_per_second", 1e9/ns);
+        std::cout << "ck45::do_batch_step: " << ns << " ns/lane step, " << 1e9/ns << " steps/s\n";
+    }
+
+    // integrate_point from the first states until convergence
+    {
+        pendulum_map<ck45> mapper;
+        const unsigned int point_count = 64;
+        unsigned long long step_count = 0;
+        unsigned long long point_total = 0;
+        const double ns = time_per_operation([&]() {
+            for (unsigned int i = 0; i < point_count; i++) {
+                point_type the_point;
+                mapper.integrate_point(the_ck45, the_system, states[i], the_point);
+                step_count += the_point.step_count;
+            }
+            point_total += point_count;
+            return point_count;
+        });
+        const double steps_per_point = double(step_count)/double(point_total);
+        QDomElement element = add_result(document, root, "integrate_point");
+        element.setAttribute("ns_per_point", ns);
+        element.setAttribute("points_per_second", 1e9/ns);
+        element.setAttribute("steps_per_point", steps_per_point);
+        element.setAttribute("steps_per_second", steps_per_point*1e9/ns);
+        std::cout << "pendulum_map::integrate_point: " << ns/1e6 << " ms/point, " << steps_per_point*1e9/ns << " steps/s\n";
+    }
+
+    // full map throughput on 1, 2, 4, ... threads up to the hardware thread count, point by point and in batch mode
+    std::vector<unsigned int> thread_counts;
+    const unsigned int hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned int nthreads = 1; nthreads < hardware_threads; nthreads *= 2) {
+        thread_counts.push_back(nthreads);
+    }
+    thread_counts.push_back(hardware_threads);
+    for (const bool batch_mode : {false, true}) {
+        double single_thread_rate = 0.0;
+        for (const unsigned int nthreads : thread_counts) {
+            thread_pool pool(nthreads);
+            pendulum_map<ck45> mapper;
+            mapper.set_map(-10.0, 10.0, -10.0, 10.0, resolution);
+            mapper.set_thread_pool(&pool);
+            mapper.set_batch_mode(batch_mode);
+            map_type the_map = mapper.create_map_container();
+            const clock_type::time_point start = clock_type::now();
+            const map_statistics statistics = mapper.parallel_integrate_map(the_system, the_ck45, the_map);
+            const std::chrono::duration<double> elapsed = clock_type::now() - start;
+            const double points_per_second = double(the_map.size())/elapsed.count();
+            if (nthreads == 1) {
+                single_thread_rate = points_per_second;
+            }
+            const double speedup = single_thread_rate > 0.0 ? points_per_second/single_thread_rate : 0.0;
+
+            QDomElement element = add_result(document, root, batch_mode ? "batch_map" : "map");
+            element.setAttribute("threads", nthreads);
+            element.setAttribute("resolution", resolution);
+            element.setAttribute("points", (unsigned int)(the_map.size()));
+            element.setAttribute("seconds", elapsed.count());
+            element.setAttribute("points_per_second", points_per_second);
+            element.setAttribute("steps_per_second", double(statistics.total_steps)/elapsed.count());
+            element.setAttribute("speedup", speedup);
+            element.setAttribute("efficiency", speedup/nthreads);
+            std::cout << (batch_mode ? "batch map, " : "map, ") << nthreads << " threads: " << points_per_second << " points/s, "
+                      << double(statistics.total_steps)/elapsed.count() << " steps/s, speedup " << speedup << '\n';
+        }
+    }
+
+    // batch mode map throughput on all hardware threads for every instruction set path the CPU supports
+    for (const cpu_isa isa : {cpu_isa::sse2, cpu_isa::avx2, cpu_isa::avx512}) {
+        if (selected_cpu_isa() < isa) {
+            break;
+        }
+        thread_pool pool(hardware_threads);
+        pendulum_map<ck45> mapper;
+        mapper.set_map(-10.0, 10.0, -10.0, 10.0, resolution);
+        mapper.set_thread_pool(&pool);
+        mapper.set_batch_mode(true);
+        mapper.set_cpu_isa(isa);
+        map_type the_map = mapper.create_map_container();
+        const clock_type::time_point start = clock_type::now();
+        mapper.parallel_integrate_map(the_system, the_ck45, the_map);
+        const std::chrono::duration<double> elapsed = clock_type::now() - start;
+        const double points_per_second = double(the_map.size())/elapsed.count();
+
+        QDomElement element = add_result(document, root, "cpu_isa_map");
+        element.setAttribute("cpu_isa", QString(cpu_isa_name(isa)));
+        element.setAttribute("points_per_second", points_per_second);
+        std::cout << "batch map, " << cpu_isa_name(isa) << " kernels: " << points_per_second << " points/s\n";
+    }
+
+    // ck45 step size controllers and initial steps on all hardware threads in batch mode, rejected steps and RHS evaluations are only
+    // counted in builds with PENDULUM_INSTRUMENTATION
+    for (const step_controller controller : {step_controller::integral, step_controller::proportional_integral}) {
+        for (const bool automatic_initial_step : {false, true}) {
+            thread_pool pool(hardware_threads);
+            pendulum_map<ck45> mapper;
+            mapper.set_map(-10.0, 10.0, -10.0, 10.0, resolution);
+            mapper.set_thread_pool(&pool);
+            mapper.set_batch_mode(true);
+            mapper.set_step_controller(controller);
+            mapper.set_automatic_initial_step(automatic_initial_step);
+            map_type the_map = mapper.create_map_container();
+            const clock_type::time_point start = clock_type::now();
+            const map_statistics statistics = mapper.parallel_integrate_map(the_system, the_ck45, the_map);
+            const std::chrono::duration<double> elapsed = clock_type::now() - start;
+            const double points_per_second = double(the_map.size())/elapsed.count();
+            const unsigned long long trial_steps = statistics.total_steps + statistics.rejected_steps;
+            const double rejected_fraction = trial_steps > 0 ? double(statistics.rejected_steps)/double(trial_steps) : 0.0;
+            const char *controller_name = controller == step_controller::integral ? "integral" : "proportional_integral";
+
+            QDomElement element = add_result(document, root, "step_control");
+            element.setAttribute("controller", QString(controller_name));
+            element.setAttribute("automatic_initial_step", automatic_initial_step ? 1 : 0);
+            element.setAttribute("points_per_second", points_per_second);
+            element.setAttribute("avg_number_of_steps", statistics.avg_step_count());
+            if (instrumentation_enabled) {
+                element.setAttribute("rejected_step_fraction", rejected_fraction);
+                element.setAttribute("rhs_evaluations", statistics.rhs_evaluations);
+            }
+            std::cout << "ck45 " << controller_name << " controller" << (automatic_initial_step ? ", automatic initial step: " : ": ")
+                      << points_per_second << " points/s, " << statistics.avg_step_count() << " steps/point";
+            if (instrumentation_enabled) {
+                std::cout << ", rejected " << rejected_fraction << ", " << statistics.rhs_evaluations << " RHS evaluations";
+            }
+            std::cout << '\n';
+        }
+    }
+
+    // double against mixed precision derivatives on all hardware threads in batch mode, time and converge position differences
+    {
+        thread_pool pool(hardware_threads);
+        pendulum_map<ck45> mapper;
+        mapper.set_map(-10.0, 10.0, -10.0, 10.0, resolution);
+        mapper.set_thread_pool(&pool);
+        mapper.set_batch_mode(true);
+        QDomElement element = add_result(document, root, "precision");
+        mapper.compare_precision(the_system, the_ck45, element);
+    }
+
+    // adaptive integrators at equal classification accuracy, on all hardware threads in batch mode
+    {
+        thread_pool pool(hardware_threads);
+        dop853 reference_integrator;
+        reference_integrator.set_tolerance(reference_tolerance, reference_tolerance);
+        map_type reference_map;
+        integrate_benchmark_map(the_system, reference_integrator, pool, resolution, reference_map);
+        compare_integrator<ck45>(document, root, the_system, pool, resolution, reference_map, target_agreement);
+        compare_integrator<bs32>(document, root, the_system, pool, resolution, reference_map, target_agreement);
+        compare_integrator<dopri54>(document, root, the_system, pool, resolution, reference_map, target_agreement);
+        compare_integrator<dop853>(document, root, the_system, pool, resolution, reference_map, target_agreement);
+    }
+
+    QFile output(output_filename);
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        std::cout << "Could not write " << output_filename.toStdString() << '\n';
+        return 1;
+    }
+    const QByteArray xml = document.toByteArray();
+    output.write(xml.data(), xml.size());
+    std::cout << "Results written to " << output_filename.toStdString() << '\n';
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef BS32_H
+#define BS32_H
+#include "fsal_rk.h"
+
+//! Coefficients of the Bogacki Shampine 3(2) method for fsal_rk, the template parameter only lets the arrays be defined in this header.
+template <typename T = void>
+struct bs32_tableau
+{
+    static const char *name() { return "bs32"; }
+    static constexpr unsigned int stage_count = 4;
+    static constexpr unsigned int order = 3;
+    static constexpr unsigned int error_order = 2;
+    static constexpr bool last_stage_is_solution = true;
+    static constexpr bool dual_error = false;
+    static constexpr double c[4] = {0.0, 1.0/2.0, 3.0/4.0, 1.0};
+    static constexpr double a[4][4] = {
+        {},
+        {1.0/2.0},
+        {0.0, 3.0/4.0},
+        {2.0/9.0, 1.0/3.0, 4.0/9.0}};
+    static constexpr double b[4] = {2.0/9.0, 1.0/3.0, 4.0/9.0, 0.0};
+    static constexpr double e[4] = {2.0/9.0-7.0/24.0, 1.0/3.0-1.0/4.0, 4.0/9.0-1.0/3.0, -1.0/8.0};
+    static constexpr double e_low[4] = {};
+};
+
+template <typename T> constexpr double bs32_tableau<T>::c[4];
+template <typename T> constexpr double bs32_tableau<T>::a[4][4];
+template <typename T> constexpr double bs32_tableau<T>::b[4];
+template <typename T> constexpr double bs32_tableau<T>::e[4];
+template <typename T> constexpr double bs32_tableau<T>::e_low[4];
+
+/*!
+ * \brief Bogacki Shampine embedded Runge Kutta order 3(2) adaptive step integrator with first same as last derivative reuse.
+ *
+ * Three derivative evaluations per step, cheaper than ck45 at the loose tolerances basin classification allows.
+ *
+ * See: P. Bogacki, L. F. Shampine. "A 3(2) pair of Runge-Kutta formulas." Applied Mathematics Letters, Vol. 2, No. 4, 1989.
+ */
+typedef fsal_rk<bs32_tableau<>> bs32;
+
+#endif // BS32_H
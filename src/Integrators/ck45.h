@@ -1,7 +1,9 @@
 #ifndef CK45_H
 #define CK45_H
+#include "step_controller.h"
 #include <array>
 #include <algorithm>
+#include <cmath>
 
 /*!
  * \brief Cash and Karp embedded Runge Kutta order 5(4) adaptive step integrator.
@@ -23,6 +25,40 @@ public:
     template<typename system, typename state_type>
     int do_step (const system &dxdt, state_type &x, double &t, double &h) const;
 
+    /*!
+     * \brief Same as do_step with the step size controller given by controller.
+     *
+     * \details The proportional integral controller also uses previous_error, the error of the last accepted step of the trajectory,
+     * which the caller keeps between the steps of a trajectory and starts at 1.0. It is updated when a step is accepted. The integral
+     * controller is the one of do_step and ignores previous_error.
+     */
+    template<typename system, typename state_type>
+    int do_step (const system &dxdt, state_type &x, double &t, double &h, step_controller controller, double &previous_error) const;
+
+    /*!
+     * \brief Performs one step in lockstep for a batch of states stored as [component][lane], each lane with its own time and step size.
+     *
+     * \details Every lane is stepped with the same arithmetic as do_step, the per lane accept/reject result is written to accepted
+     * (1 or 0) and rejected lanes keep their state and time while their step size is reduced. The loops run across lanes so the
+     * compiler can vectorize the stages over several points at once.
+     */
+    template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+    void do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted) const;
+
+    //! Same as do_batch_step with the step size controller given by controller and the previous_error of every lane, see do_step.
+    template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+    void do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted, step_controller controller, lane_array &previous_error) const;
+
+    /*!
+     * \brief Estimate of the first step size of a trajectory starting at state x and time t, limited to the maximum step size.
+     *
+     * \details The step for which an explicit Euler step would have an error of 1% of the tolerances, scaled to the order of the
+     * method, from two derivative evaluations. See: E. Hairer, S. P. Norsett, G. Wanner. "Solving Ordinary Differential Equations I:
+     * Nonstiff Problems." Springer, 2nd edition, 1993, section II.4.
+     */
+    template<typename system, typename state_type>
+    double initial_step (const system &dxdt, const state_type &x, double t) const;
+
     /*!
      * \brief Set error tolerances for the integrator.
      * \param relative_tolerance The relative error tolerance, controls the steps relative to the size of the step taken.
@@ -36,11 +72,22 @@ public:
 
     //! Set the maximum step size the integrator can take.
     void set_max_step_size(double max_step_size);
+
+    //! Name of the method, recorded in result files.
+    static const char *name() { return "ck45"; }
+
+    double relative_tolerance() const { return m_rel_tol; }
+    double absolute_tolerance() const { return m_abs_tol; }
+    double max_step_size() const { return m_max_step_size; }
 private:
     double m_rel_tol = 1e-6;
     double m_abs_tol = 1e-6;
     double m_max_step_size = 0.1;
 
+    // exponents of the error of the step and of the previous step of the PI controller, Gustafsson's 0.7/k and 0.4/k for k = 5
+    static constexpr double pi_alpha = 0.7/5.0;
+    static constexpr double pi_beta = 0.4/5.0;
+
     // coefficients for method
     static constexpr double c[6] = {0.0, 1.0/5.0, 3.0/10.0, 3.0/5.0, 1.0, 7.0/8.0};
     static constexpr double b_5th[6] = {37.0/378.0, 0.0, 250.0/621.0, 125.0/594.0, 0.0, 512.0/1771.0};
@@ -57,6 +104,13 @@ private:
 
 template<typename system, typename state_type>
 int ck45::do_step (const system &dxdt, state_type &x, double &t, double &h) const
+{
+    double previous_error = 1.0;
+    return do_step(dxdt, x, t, h, step_controller::integral, previous_error);
+}
+
+template<typename system, typename state_type>
+int ck45::do_step (const system &dxdt, state_type &x, double &t, double &h, step_controller controller, double &previous_error) const
 {
     const unsigned int state_size = x.size();
     std::array<state_type, 6> k;
@@ -112,6 +166,17 @@ int ck45::do_step (const system &dxdt, state_type &x, double &t, double &h) cons
         h = h*std::max(0.9*std::pow(max_error_val, -0.25), 0.2);
         return 0;
     }
+    else if (controller == step_controller::proportional_integral)
+    {
+        // use step and let the error of this and the previous accepted step set the step size
+        t = t+h;
+        for (unsigned int i = 0; i < state_size; i++) {
+            x[i] = x[i] + order_5_solution[i];
+        }
+        h = std::min(h*std::min(std::max(0.9*std::pow(max_error_val, -pi_alpha)*std::pow(previous_error, pi_beta), 0.2), 5.0), m_max_step_size);
+        previous_error = std::max(max_error_val, 1e-4);
+        return 1;
+    }
     else
     {
         if (max_error_val < 0.5) {
@@ -135,6 +200,161 @@ int ck45::do_step (const system &dxdt, state_type &x, double &t, double &h) cons
     }
 }
 
+template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+void ck45::do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted) const
+{
+    lane_array previous_error;
+    do_batch_step(dxdt, x, t, h, accepted, step_controller::integral, previous_error);
+}
+
+template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+void ck45::do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted, step_controller controller, lane_array &previous_error) const
+{
+    const unsigned int state_size = x.size();
+    const unsigned int lanes = t.size();
+    std::array<batch_state, 6> k;
+    batch_state temp_state;
+    lane_array stage_time;
+    dxdt(x, k[0], t);
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            temp_state[i][l] = x[i][l]+h[l]*a[1][0]*k[0][i][l];
+        }
+    }
+    for (unsigned int l = 0; l < lanes; l++) {
+        stage_time[l] = t[l]+c[1]*h[l];
+    }
+    dxdt(temp_state, k[1], stage_time);
+
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            temp_state[i][l] = x[i][l]+h[l]*(a[2][0]*k[0][i][l]+a[2][1]*k[1][i][l]);
+        }
+    }
+    for (unsigned int l = 0; l < lanes; l++) {
+        stage_time[l] = t[l]+c[2]*h[l];
+    }
+    dxdt(temp_state, k[2], stage_time);
+
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            temp_state[i][l] = x[i][l]+h[l]*(a[3][0]*k[0][i][l]+a[3][1]*k[1][i][l]+a[3][2]*k[2][i][l]);
+        }
+    }
+    for (unsigned int l = 0; l < lanes; l++) {
+        stage_time[l] = t[l]+c[3]*h[l];
+    }
+    dxdt(temp_state, k[3], stage_time);
+
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            temp_state[i][l] = x[i][l]+h[l]*(a[4][0]*k[0][i][l]+a[4][1]*k[1][i][l]+a[4][2]*k[2][i][l]+a[4][3]*k[3][i][l]);
+        }
+    }
+    for (unsigned int l = 0; l < lanes; l++) {
+        stage_time[l] = t[l]+c[4]*h[l];
+    }
+    dxdt(temp_state, k[4], stage_time);
+
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            temp_state[i][l] = x[i][l]+h[l]*(a[5][0]*k[0][i][l]+a[5][1]*k[1][i][l]+a[5][2]*k[2][i][l]+a[5][3]*k[3][i][l]+a[5][4]*k[4][i][l]);
+        }
+    }
+    for (unsigned int l = 0; l < lanes; l++) {
+        stage_time[l] = t[l]+c[5]*h[l];
+    }
+    dxdt(temp_state, k[5], stage_time);
+
+    batch_state order_5_solution;
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            order_5_solution[i][l] = h[l]*(b_5th[0]*k[0][i][l]+b_5th[1]*k[1][i][l]+b_5th[2]*k[2][i][l]+b_5th[3]*k[3][i][l]+b_5th[4]*k[4][i][l]+b_5th[5]*k[5][i][l]);
+        }
+    }
+
+    // boost odeint syle error step sizing method, the max over the state components is kept per lane
+    lane_array max_error_val;
+    for (unsigned int l = 0; l < lanes; l++) {
+        max_error_val[l] = 0.0;
+    }
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            const double error_step = h[l]*(b_diff[0]*k[0][i][l]+b_diff[1]*k[1][i][l]+b_diff[2]*k[2][i][l]+b_diff[3]*k[3][i][l]+b_diff[4]*k[4][i][l]+b_diff[5]*k[5][i][l]);
+            max_error_val[l] = std::max(max_error_val[l], std::abs(error_step/(m_abs_tol + m_rel_tol * (x[i][l] + order_5_solution[i][l]))));
+        }
+    }
+
+    // same step size rules as do_step, written as selects so every lane takes the same path
+    if (controller == step_controller::proportional_integral) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            const double error_val = max_error_val[l];
+            const bool accept = !(error_val > 1.0);
+            const double pi_h = std::min(h[l]*std::min(std::max(0.9*std::pow(error_val, -pi_alpha)*std::pow(previous_error[l], pi_beta), 0.2), 5.0), m_max_step_size);
+            const double shrunk_h = h[l]*std::max(0.9*std::pow(error_val, -0.25), 0.2);
+            accepted[l] = accept ? 1 : 0;
+            t[l] = accept ? t[l]+h[l] : t[l];
+            h[l] = accept ? pi_h : shrunk_h;
+            previous_error[l] = accept ? std::max(error_val, 1e-4) : previous_error[l];
+        }
+    } else {
+        for (unsigned int l = 0; l < lanes; l++) {
+            const double error_val = max_error_val[l];
+            const bool accept = !(error_val > 1.0);
+            const double factor = 0.9*std::pow(error_val, accept ? -0.20 : -0.25);
+            const double grown_h = (error_val < 0.5) ? std::min(h[l]*std::min(factor, 5.0), m_max_step_size) : h[l];
+            const double shrunk_h = h[l]*std::max(factor, 0.2);
+            accepted[l] = accept ? 1 : 0;
+            t[l] = accept ? t[l]+h[l] : t[l];
+            h[l] = accept ? grown_h : shrunk_h;
+        }
+    }
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            x[i][l] = accepted[l] ? x[i][l] + order_5_solution[i][l] : x[i][l];
+        }
+    }
+}
+
+template<typename system, typename state_type>
+double ck45::initial_step (const system &dxdt, const state_type &x, double t) const
+{
+    const unsigned int state_size = x.size();
+    state_type dxdt_x;
+    dxdt(x, dxdt_x, t);
+
+    // root mean square norms of the state and its derivative relative to the tolerances
+    state_type scale;
+    double state_norm = 0.0;
+    double derivative_norm = 0.0;
+    for (unsigned int i = 0; i < state_size; i++) {
+        scale[i] = m_abs_tol + m_rel_tol*std::abs(x[i]);
+        state_norm += (x[i]/scale[i])*(x[i]/scale[i]);
+        derivative_norm += (dxdt_x[i]/scale[i])*(dxdt_x[i]/scale[i]);
+    }
+    state_norm = std::sqrt(state_norm/state_size);
+    derivative_norm = std::sqrt(derivative_norm/state_size);
+    double euler_h = (state_norm < 1e-5 || derivative_norm < 1e-5) ? 1e-6 : 0.01*state_norm/derivative_norm;
+    euler_h = std::min(euler_h, m_max_step_size);
+
+    // second derivative estimate from an explicit Euler step
+    state_type euler_state;
+    state_type dxdt_euler;
+    for (unsigned int i = 0; i < state_size; i++) {
+        euler_state[i] = x[i]+euler_h*dxdt_x[i];
+    }
+    dxdt(euler_state, dxdt_euler, t+euler_h);
+    double second_derivative_norm = 0.0;
+    for (unsigned int i = 0; i < state_size; i++) {
+        second_derivative_norm += ((dxdt_euler[i]-dxdt_x[i])/scale[i])*((dxdt_euler[i]-dxdt_x[i])/scale[i]);
+    }
+    second_derivative_norm = std::sqrt(second_derivative_norm/state_size)/euler_h;
+
+    const double max_norm = std::max(derivative_norm, second_derivative_norm);
+    const double order_h = (max_norm <= 1e-15) ? std::max(1e-6, euler_h*1e-3) : std::pow(0.01/max_norm, 1.0/5.0);
+    return std::min(std::min(100.0*euler_h, order_h), m_max_step_size);
+}
+
 void ck45::set_tolerance(double relative_tolerance, double absolute_tolerance)
 {
     m_rel_tol = relative_tolerance;
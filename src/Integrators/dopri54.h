@@ -0,0 +1,47 @@
+#ifndef DOPRI54_H
+#define DOPRI54_H
+#include "fsal_rk.h"
+
+//! Coefficients of the Dormand Prince 5(4) method for fsal_rk, the template parameter only lets the arrays be defined in this header.
+template <typename T = void>
+struct dopri54_tableau
+{
+    static const char *name() { return "dopri54"; }
+    static constexpr unsigned int stage_count = 7;
+    static constexpr unsigned int order = 5;
+    static constexpr unsigned int error_order = 4;
+    static constexpr bool last_stage_is_solution = true;
+    static constexpr bool dual_error = false;
+    static constexpr double c[7] = {0.0, 1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0, 1.0};
+    static constexpr double a[7][7] = {
+        {},
+        {1.0/5.0},
+        {3.0/40.0, 9.0/40.0},
+        {44.0/45.0, -56.0/15.0, 32.0/9.0},
+        {19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0},
+        {9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0},
+        {35.0/384.0, 0.0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0}};
+    static constexpr double b[7] = {35.0/384.0, 0.0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0, 0.0};
+    static constexpr double e[7] = {35.0/384.0-5179.0/57600.0, 0.0, 500.0/1113.0-7571.0/16695.0, 125.0/192.0-393.0/640.0,
+                                    -2187.0/6784.0+92097.0/339200.0, 11.0/84.0-187.0/2100.0, -1.0/40.0};
+    static constexpr double e_low[7] = {};
+};
+
+template <typename T> constexpr double dopri54_tableau<T>::c[7];
+template <typename T> constexpr double dopri54_tableau<T>::a[7][7];
+template <typename T> constexpr double dopri54_tableau<T>::b[7];
+template <typename T> constexpr double dopri54_tableau<T>::e[7];
+template <typename T> constexpr double dopri54_tableau<T>::e_low[7];
+
+/*!
+ * \brief Dormand Prince embedded Runge Kutta order 5(4) adaptive step integrator with first same as last derivative reuse.
+ *
+ * Seven stages of which the first is carried over from the previous step, so the same six derivative evaluations per step as ck45
+ * with the smaller error constants of a method tuned for the propagated 5th order solution.
+ *
+ * See: J. R. Dormand, P. J. Prince. "A family of embedded Runge-Kutta formulae." Journal of Computational and Applied Mathematics,
+ * Vol. 6, No. 1, 1980.
+ */
+typedef fsal_rk<dopri54_tableau<>> dopri54;
+
+#endif // DOPRI54_H
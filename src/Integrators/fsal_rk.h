@@ -0,0 +1,290 @@
+#ifndef FSAL_RK_H
+#define FSAL_RK_H
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+/*!
+ * \brief Embedded explicit Runge Kutta integrator that reuses the derivative at the end of a step as the first stage of the next one
+ * (first same as last, FSAL). The method is given by a tableau, see bs32, dopri54 and dop853.
+ *
+ * \details The caller keeps the derivative between steps (the step memory): do_step with a dxdt_x argument expects it to hold the
+ * derivative at (x, t), replaces it with the derivative at the new state when the step is accepted and leaves it as is when the step is
+ * rejected. A point is started by evaluating the system at its start state once. The do_step without dxdt_x evaluates that derivative
+ * itself, so it follows the same contract as ck45::do_step at the cost of one extra evaluation per step.
+ *
+ * The tableau provides the stage coefficients c, a, the solution weights b and the error weights e (solution minus embedded solution),
+ * with last_stage_is_solution set when the last stage is evaluated at the new state (its row of a is b) so it is the next derivative.
+ * Otherwise the derivative at the new state is evaluated once a step is accepted. Tableaus with dual_error combine the error e with a
+ * second, lower order estimate e_low as in Hairer's DOP853.
+ *
+ * The step size rules are the ones of ck45 with the exponents of the orders of the method. The error of every component is relative to
+ * the absolute tolerance plus the relative tolerance times the larger magnitude of the component before and after the step.
+ */
+template <typename tableau>
+class fsal_rk
+{
+public:
+    fsal_rk() {}
+
+    //! Performs one step for a given state and system, updates the state, time and step size. Returns 1 if successful, 0 if not; in either case updates the step size.
+    template<typename system, typename state_type>
+    int do_step (const system &dxdt, state_type &x, double &t, double &h) const;
+
+    //! Same as do_step, starting from the derivative dxdt_x at (x, t) which is updated to the derivative at the new state if the step is successful.
+    template<typename system, typename state_type>
+    int do_step (const system &dxdt, state_type &x, state_type &dxdt_x, double &t, double &h) const;
+
+    //! Performs one step in lockstep for a batch of states stored as [component][lane], see ck45::do_batch_step.
+    template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+    void do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted) const;
+
+    //! Same as do_batch_step, starting from the derivatives dxdt_x of the lanes which are updated for the lanes whose step is successful.
+    template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+    void do_batch_step (const system &dxdt, batch_state &x, batch_state &dxdt_x, lane_array &t, lane_array &h, lane_mask &accepted) const;
+
+    //! Set error tolerances for the integrator, see ck45::set_tolerance.
+    void set_tolerance(double relative_tolerance, double absolute_tolerance);
+
+    //! Set the maximum step size the integrator can take.
+    void set_max_step_size(double max_step_size);
+
+    //! Name of the method, recorded in result files.
+    static const char *name() { return tableau::name(); }
+
+    double relative_tolerance() const { return m_rel_tol; }
+    double absolute_tolerance() const { return m_abs_tol; }
+    double max_step_size() const { return m_max_step_size; }
+private:
+    double m_rel_tol = 1e-6;
+    double m_abs_tol = 1e-6;
+    double m_max_step_size = 0.1;
+
+    static constexpr unsigned int stages = tableau::stage_count;
+
+    // error of a component step relative to the tolerance
+    double error_ratio(double error_step, double x, double new_x) const;
+
+    // combined error of the dual estimate tableaus from the main and the lower order error
+    static double combine_error(double error_val, double low_error_val);
+
+    // accept or reject a step with error error_val and update the step size h
+    bool control(double error_val, double &h) const;
+};
+
+template <typename tableau>
+template<typename system, typename state_type>
+int fsal_rk<tableau>::do_step (const system &dxdt, state_type &x, double &t, double &h) const
+{
+    state_type dxdt_x;
+    dxdt(x, dxdt_x, t);
+    return do_step(dxdt, x, dxdt_x, t, h);
+}
+
+template <typename tableau>
+template<typename system, typename state_type>
+int fsal_rk<tableau>::do_step (const system &dxdt, state_type &x, state_type &dxdt_x, double &t, double &h) const
+{
+    const unsigned int state_size = x.size();
+    std::array<state_type, stages> k;
+    state_type temp_state; // state for the next stage, after the last stage the new state when the last stage is the solution
+    k[0] = dxdt_x;
+    for (unsigned int s = 1; s < stages; s++) {
+        for (unsigned int i = 0; i < state_size; i++) {
+            double sum = 0.0;
+            for (unsigned int j = 0; j < s; j++) {
+                sum += tableau::a[s][j]*k[j][i];
+            }
+            temp_state[i] = x[i]+h*sum;
+        }
+        dxdt(temp_state, k[s], t+tableau::c[s]*h);
+    }
+
+    state_type new_state;
+    if (tableau::last_stage_is_solution) {
+        new_state = temp_state;
+    } else {
+        for (unsigned int i = 0; i < state_size; i++) {
+            double sum = 0.0;
+            for (unsigned int j = 0; j < stages; j++) {
+                sum += tableau::b[j]*k[j][i];
+            }
+            new_state[i] = x[i]+h*sum;
+        }
+    }
+
+    double max_error_val = 0.0;
+    double max_low_error_val = 0.0;
+    for (unsigned int i = 0; i < state_size; i++) {
+        double error_sum = 0.0;
+        double low_error_sum = 0.0;
+        for (unsigned int j = 0; j < stages; j++) {
+            error_sum += tableau::e[j]*k[j][i];
+            low_error_sum += tableau::e_low[j]*k[j][i];
+        }
+        max_error_val = std::max(max_error_val, error_ratio(h*error_sum, x[i], new_state[i]));
+        if (tableau::dual_error) {
+            max_low_error_val = std::max(max_low_error_val, error_ratio(h*low_error_sum, x[i], new_state[i]));
+        }
+    }
+    if (tableau::dual_error) {
+        max_error_val = combine_error(max_error_val, max_low_error_val);
+    }
+
+    const double step = h;
+    if (!control(max_error_val, h)) {
+        return 0;
+    }
+    t = t+step;
+    x = new_state;
+    if (tableau::last_stage_is_solution) {
+        dxdt_x = k[stages-1];
+    } else {
+        dxdt(x, dxdt_x, t);
+    }
+    return 1;
+}
+
+template <typename tableau>
+template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+void fsal_rk<tableau>::do_batch_step (const system &dxdt, batch_state &x, lane_array &t, lane_array &h, lane_mask &accepted) const
+{
+    batch_state dxdt_x;
+    dxdt(x, dxdt_x, t);
+    do_batch_step(dxdt, x, dxdt_x, t, h, accepted);
+}
+
+template <typename tableau>
+template<typename system, typename batch_state, typename lane_array, typename lane_mask>
+void fsal_rk<tableau>::do_batch_step (const system &dxdt, batch_state &x, batch_state &dxdt_x, lane_array &t, lane_array &h, lane_mask &accepted) const
+{
+    const unsigned int state_size = x.size();
+    const unsigned int lanes = t.size();
+    std::array<batch_state, stages> k;
+    batch_state temp_state;
+    lane_array stage_time;
+    k[0] = dxdt_x;
+    for (unsigned int s = 1; s < stages; s++) {
+        for (unsigned int i = 0; i < state_size; i++) {
+            for (unsigned int l = 0; l < lanes; l++) {
+                double sum = 0.0;
+                for (unsigned int j = 0; j < s; j++) {
+                    sum += tableau::a[s][j]*k[j][i][l];
+                }
+                temp_state[i][l] = x[i][l]+h[l]*sum;
+            }
+        }
+        for (unsigned int l = 0; l < lanes; l++) {
+            stage_time[l] = t[l]+tableau::c[s]*h[l];
+        }
+        dxdt(temp_state, k[s], stage_time);
+    }
+
+    batch_state new_state;
+    if (tableau::last_stage_is_solution) {
+        new_state = temp_state;
+    } else {
+        for (unsigned int i = 0; i < state_size; i++) {
+            for (unsigned int l = 0; l < lanes; l++) {
+                double sum = 0.0;
+                for (unsigned int j = 0; j < stages; j++) {
+                    sum += tableau::b[j]*k[j][i][l];
+                }
+                new_state[i][l] = x[i][l]+h[l]*sum;
+            }
+        }
+    }
+
+    // the max over the state components is kept per lane
+    lane_array max_error_val;
+    lane_array max_low_error_val;
+    for (unsigned int l = 0; l < lanes; l++) {
+        max_error_val[l] = 0.0;
+        max_low_error_val[l] = 0.0;
+    }
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            double error_sum = 0.0;
+            double low_error_sum = 0.0;
+            for (unsigned int j = 0; j < stages; j++) {
+                error_sum += tableau::e[j]*k[j][i][l];
+                low_error_sum += tableau::e_low[j]*k[j][i][l];
+            }
+            max_error_val[l] = std::max(max_error_val[l], error_ratio(h[l]*error_sum, x[i][l], new_state[i][l]));
+            if (tableau::dual_error) {
+                max_low_error_val[l] = std::max(max_low_error_val[l], error_ratio(h[l]*low_error_sum, x[i][l], new_state[i][l]));
+            }
+        }
+    }
+
+    // same step size rules as do_step, written as selects so every lane takes the same path
+    bool any_accepted = false;
+    for (unsigned int l = 0; l < lanes; l++) {
+        const double error_val = tableau::dual_error ? combine_error(max_error_val[l], max_low_error_val[l]) : max_error_val[l];
+        const double step = h[l];
+        const bool accept = control(error_val, h[l]);
+        accepted[l] = accept ? 1 : 0;
+        t[l] = accept ? t[l]+step : t[l];
+        any_accepted = any_accepted || accept;
+    }
+    for (unsigned int i = 0; i < state_size; i++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            x[i][l] = accepted[l] ? new_state[i][l] : x[i][l];
+        }
+    }
+    if (tableau::last_stage_is_solution) {
+        for (unsigned int i = 0; i < state_size; i++) {
+            for (unsigned int l = 0; l < lanes; l++) {
+                dxdt_x[i][l] = accepted[l] ? k[stages-1][i][l] : dxdt_x[i][l];
+            }
+        }
+    } else if (any_accepted) {
+        // the whole batch is evaluated at its new time, rejected lanes keep their derivative
+        batch_state new_dxdt;
+        dxdt(x, new_dxdt, t);
+        for (unsigned int i = 0; i < state_size; i++) {
+            for (unsigned int l = 0; l < lanes; l++) {
+                dxdt_x[i][l] = accepted[l] ? new_dxdt[i][l] : dxdt_x[i][l];
+            }
+        }
+    }
+}
+
+template <typename tableau>
+inline double fsal_rk<tableau>::error_ratio(double error_step, double x, double new_x) const
+{
+    return std::abs(error_step)/(m_abs_tol + m_rel_tol*std::max(std::abs(x), std::abs(new_x)));
+}
+
+template <typename tableau>
+inline double fsal_rk<tableau>::combine_error(double error_val, double low_error_val)
+{
+    const double denominator = error_val*error_val + 0.01*low_error_val*low_error_val;
+    return denominator > 0.0 ? error_val*error_val/std::sqrt(denominator) : 0.0;
+}
+
+template <typename tableau>
+inline bool fsal_rk<tableau>::control(double error_val, double &h) const
+{
+    const bool accept = !(error_val > 1.0);
+    const double factor = 0.9*std::pow(error_val, accept ? -1.0/tableau::order : -1.0/tableau::error_order);
+    const double grown_h = (error_val < 0.5) ? std::min(h*std::min(factor, 5.0), m_max_step_size) : h;
+    const double shrunk_h = h*std::max(factor, 0.2);
+    h = accept ? grown_h : shrunk_h;
+    return accept;
+}
+
+template <typename tableau>
+void fsal_rk<tableau>::set_tolerance(double relative_tolerance, double absolute_tolerance)
+{
+    m_rel_tol = relative_tolerance;
+    m_abs_tol = absolute_tolerance;
+}
+
+template <typename tableau>
+void fsal_rk<tableau>::set_max_step_size(double max_step_size)
+{
+    m_max_step_size = max_step_size;
+}
+
+#endif // FSAL_RK_H
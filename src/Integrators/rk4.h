@@ -12,6 +12,9 @@ class rk4
 public:
     rk4() {}
 
+    //! Name of the method, recorded in result files.
+    static const char *name() { return "rk4"; }
+
     //! Performs one step and returns 1.
     template<typename system, typename state_type>
     int do_step (const system &dxdt, state_type &x, double &t, const double h)
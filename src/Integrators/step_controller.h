@@ -0,0 +1,11 @@
+#ifndef STEP_CONTROLLER_H
+#define STEP_CONTROLLER_H
+
+//! Step size controllers of the adaptive integrators that offer a choice (see ck45).
+enum class step_controller
+{
+    integral, //!< the new step size follows the error of the last step, the classic controller
+    proportional_integral //!< Gustafsson's PI controller, the error of the previous accepted step damps the step size changes
+};
+
+#endif // STEP_CONTROLLER_H
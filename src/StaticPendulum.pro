@@ -14,14 +14,31 @@ TEMPLATE = app
 QMAKE_CXXFLAGS += -std=c++1y
 QMAKE_CXXFLAGS += -pthread
 QMAKE_CXXFLAGS_RELEASE += -ffast-math
-QMAKE_CXXFLAGS_RELEASE += -march=native
+# no -march=native, the batch mode step is compiled for SSE2, AVX2 and AVX-512 and picked at runtime, see cpu_dispatch.h
 QMAKE_CXXFLAGS_RELEASE += -funroll-loops
+# DEFINES += PENDULUM_INSTRUMENTATION # record rejected steps, RHS evaluations and tile costs, see instrumentation.h
 SOURCES += main.cpp
 
 HEADERS += \
     pendulum_system.h \
     pendulum_map.h \
+    tile_scheduler.h \
+    thread_pool.h \
+    image_writer.h \
+    map_grid.h \
+    convergence_cache.h \
+    map_sweep.h \
+    map_file.h \
+    instrumentation.h \
+    cpu_dispatch.h \
+    tile_cache.h \
+    render_daemon.h \
     Integrators/ck45.h \
-    Integrators/rk4.h
+    Integrators/step_controller.h \
+    Integrators/rk4.h \
+    Integrators/fsal_rk.h \
+    Integrators/bs32.h \
+    Integrators/dopri54.h \
+    Integrators/dop853.h
 
 LIBS += -pthread
@@ -0,0 +1,192 @@
+#ifndef CONVERGENCE_CACHE_H
+#define CONVERGENCE_CACHE_H
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+typedef std::array< double , 4 > state_type;
+
+/*!
+ * \brief Lock-free hash table over quantized (x, y, vx, vy) cells that remembers where trajectories through a cell converged.
+ *
+ * \details Once a trajectory converges the cells of its last states are recorded with the converge position and the time that was
+ * left until convergence. A later trajectory reaching a recorded cell can stop right away with that converge position and an
+ * extrapolated converge time. The table is shared by all threads of a map integration: each slot is a pair of 64 bit atomics, the key
+ * is claimed with a compare and swap and the value is published afterwards, so readers never block and a slot whose value is not
+ * written yet reads as unknown. Cells are first come first served, a record that finds no free slot within max_probes is dropped.
+ * Quantization is an approximation, cells must be small compared to the basin structure for the cache to agree with full integration.
+ * Cells are keyed by an owner hash along with the state, the hash of the system and settings the trajectories were integrated with
+ * (see pendulum_map::set_convergence_cache), so maps of different systems sharing a cache never read each other's cells.
+ */
+class convergence_cache
+{
+public:
+    //! Create a cache with 2^table_bits slots over cells of position_cell in x and y and velocity_cell in vx and vy.
+    convergence_cache(unsigned int table_bits = 20, double position_cell = 0.02, double velocity_cell = 0.05);
+
+    //! Find the cell of state recorded by owner, returns true and sets the converge position and remaining converge time if the cell is known.
+    bool lookup(std::uint64_t owner, const state_type &state, unsigned int &converge_position, double &remaining_time) const;
+
+    //! Record for owner that a trajectory through the cell of state converged to converge_position remaining_time later.
+    void record(std::uint64_t owner, const state_type &state, unsigned int converge_position, double remaining_time);
+
+    //! Forget all cells, must not run concurrently with lookup or record.
+    void clear();
+
+    //! Number of recorded cells.
+    std::size_t size() const;
+
+    //! Number of slots in the table.
+    std::size_t capacity() const;
+private:
+    static const unsigned int max_probes = 8;
+    std::size_t m_mask;
+    double m_position_scale; // inverse cell sizes
+    double m_velocity_scale;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_keys; // 0 for a free slot, cell hash with the top bit set otherwise
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_values; // 0 until written, then valid bit | float remaining time << 8 | converge position
+    std::atomic<std::size_t> m_size;
+
+    // hash of the owner and the quantized cell of a state with the top bit set so it is never 0
+    std::uint64_t cell_key(std::uint64_t owner, const state_type &state) const;
+};
+
+/*!
+ * \brief The last states of a trajectory, kept in a fixed ring so integration does not allocate.
+ *
+ * \details The integration loop adds a state every few steps and records the trail into a convergence_cache once the trajectory converges.
+ */
+class convergence_trail
+{
+public:
+    //! Start a new trajectory.
+    void clear();
+
+    //! Add a state at time t, overwriting the oldest state once trail_length states are kept.
+    void add(const state_type &state, double t);
+
+    //! Record the kept states in the cache for owner as converging to converge_position at converge_time.
+    void record(convergence_cache &cache, std::uint64_t owner, unsigned int converge_position, double converge_time) const;
+private:
+    static const unsigned int trail_length = 64;
+    struct sample
+    {
+        state_type state;
+        double t;
+    };
+    std::array<sample, trail_length> m_samples;
+    unsigned int m_count = 0;
+};
+
+inline convergence_cache::convergence_cache(unsigned int table_bits, double position_cell, double velocity_cell)
+    : m_mask((std::size_t(1) << table_bits) - 1), m_position_scale(1.0/position_cell), m_velocity_scale(1.0/velocity_cell),
+      m_keys(new std::atomic<std::uint64_t>[m_mask+1]), m_values(new std::atomic<std::uint64_t>[m_mask+1])
+{
+    clear();
+}
+
+inline std::uint64_t convergence_cache::cell_key(std::uint64_t owner, const state_type &state) const
+{
+    const double scale[4] = {m_position_scale, m_position_scale, m_velocity_scale, m_velocity_scale};
+    std::uint64_t hash = 0x9e3779b97f4a7c15ull ^ owner;
+    for (unsigned int i = 0; i < 4; i++) {
+        // splitmix style mixing of each quantized coordinate
+        hash ^= std::uint64_t(std::int64_t(std::floor(state[i]*scale[i])));
+        hash *= 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 31;
+        hash *= 0x94d049bb133111ebull;
+        hash ^= hash >> 29;
+    }
+    return hash | (std::uint64_t(1) << 63);
+}
+
+inline bool convergence_cache::lookup(std::uint64_t owner, const state_type &state, unsigned int &converge_position, double &remaining_time) const
+{
+    const std::uint64_t key = cell_key(owner, state);
+    for (unsigned int probe = 0; probe < max_probes; probe++) {
+        const std::size_t slot = (key + probe) & m_mask;
+        const std::uint64_t slot_key = m_keys[slot].load(std::memory_order_acquire);
+        if (slot_key == 0) {
+            return false;
+        }
+        if (slot_key == key) {
+            const std::uint64_t value = m_values[slot].load(std::memory_order_acquire);
+            if (value == 0) {
+                return false; // claimed but not written yet
+            }
+            const std::uint32_t time_bits = std::uint32_t(value >> 8);
+            float time;
+            std::memcpy(&time, &time_bits, sizeof(time));
+            converge_position = value & 0xff;
+            remaining_time = time;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void convergence_cache::record(std::uint64_t owner, const state_type &state, unsigned int converge_position, double remaining_time)
+{
+    const std::uint64_t key = cell_key(owner, state);
+    const float time = float(remaining_time);
+    std::uint32_t time_bits;
+    std::memcpy(&time_bits, &time, sizeof(time));
+    const std::uint64_t value = (std::uint64_t(1) << 63) | (std::uint64_t(time_bits) << 8) | (converge_position & 0xff);
+    for (unsigned int probe = 0; probe < max_probes; probe++) {
+        const std::size_t slot = (key + probe) & m_mask;
+        std::uint64_t slot_key = m_keys[slot].load(std::memory_order_relaxed);
+        if (slot_key == 0 && m_keys[slot].compare_exchange_strong(slot_key, key, std::memory_order_acq_rel)) {
+            m_values[slot].store(value, std::memory_order_release);
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (slot_key == key) {
+            return; // cell already known
+        }
+    }
+}
+
+inline void convergence_cache::clear()
+{
+    for (std::size_t slot = 0; slot <= m_mask; slot++) {
+        m_keys[slot].store(0, std::memory_order_relaxed);
+        m_values[slot].store(0, std::memory_order_relaxed);
+    }
+    m_size.store(0);
+}
+
+inline std::size_t convergence_cache::size() const
+{
+    return m_size.load(std::memory_order_relaxed);
+}
+
+inline std::size_t convergence_cache::capacity() const
+{
+    return m_mask + 1;
+}
+
+inline void convergence_trail::clear()
+{
+    m_count = 0;
+}
+
+inline void convergence_trail::add(const state_type &state, double t)
+{
+    sample &the_sample = m_samples[m_count % trail_length];
+    the_sample.state = state;
+    the_sample.t = t;
+    m_count++;
+}
+
+inline void convergence_trail::record(convergence_cache &cache, std::uint64_t owner, unsigned int converge_position, double converge_time) const
+{
+    const unsigned int count = m_count < trail_length ? m_count : trail_length;
+    for (unsigned int i = 0; i < count; i++) {
+        cache.record(owner, m_samples[i].state, converge_position, converge_time - m_samples[i].t);
+    }
+}
+
+#endif // CONVERGENCE_CACHE_H
@@ -0,0 +1,100 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+/*!
+ * \brief Instruction set paths of the integration kernels, selected at runtime by dispatch_cpu_isa.
+ *
+ * \details The project is built for the baseline x86-64 instruction set (SSE2) so one binary runs on every node. The lockstep step of
+ * the pendulum_map batch mode is compiled once more for AVX2 with FMA and once for AVX-512, and the best path the CPU and the operating
+ * system support is taken. On other architectures there is only the baseline path. The paths do not give bitwise identical results,
+ * the compiler contracts multiplies and adds into FMA instructions on AVX2 and AVX-512, so result files and the tile cache key record
+ * the path (see map_file_isa_avx2).
+ */
+enum class cpu_isa
+{
+    sse2, //!< baseline x86-64 build
+    avx2, //!< AVX2 and FMA, 4 doubles per vector
+    avx512 //!< AVX-512 F and DQ, 8 doubles per vector, one register per batch_lanes lanes
+};
+
+//! Name of an instruction set path for logs and result files.
+inline const char *cpu_isa_name(cpu_isa isa)
+{
+    switch (isa) {
+    case cpu_isa::avx512:
+        return "avx512";
+    case cpu_isa::avx2:
+        return "avx2";
+    default:
+        return "sse2";
+    }
+}
+
+//! Best instruction set path the CPU supports, detected once on the first call. The detection also checks that the operating system saves the vector registers.
+inline cpu_isa selected_cpu_isa()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static const cpu_isa isa = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+            return cpu_isa::avx512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return cpu_isa::avx2;
+        }
+        return cpu_isa::sse2;
+    }();
+    return isa;
+#else
+    return cpu_isa::sse2;
+#endif
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// flatten inlines everything f calls into these, so the whole kernel is compiled for the target of the wrapper
+template <typename function>
+__attribute__((target("avx512f,avx512dq,avx2,fma"), flatten)) void run_avx512_kernel(function &f)
+{
+    f();
+}
+
+template <typename function>
+__attribute__((target("avx2,fma"), flatten)) void run_avx2_kernel(function &f)
+{
+    f();
+}
+#endif
+
+/*!
+ * \brief Calls f() compiled for the instruction set path isa, which must be supported by the CPU (at most selected_cpu_isa()).
+ *
+ * \details The kernel is everything f calls that the compiler can inline, so f should be a lambda or function object around a whole loop
+ * of integrations whose callees are templates or inline functions. Calls through function pointers, std::function or out of line functions
+ * stay in the baseline build. Every path instantiates f once more.
+ */
+template <typename function>
+void dispatch_cpu_isa(cpu_isa isa, function &&f)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (isa == cpu_isa::avx512) {
+        run_avx512_kernel(f);
+        return;
+    }
+    if (isa == cpu_isa::avx2) {
+        run_avx2_kernel(f);
+        return;
+    }
+#else
+    (void)isa;
+#endif
+    f();
+}
+
+//! Calls f() compiled for selected_cpu_isa(), see dispatch_cpu_isa.
+template <typename function>
+void dispatch_cpu_isa(function &&f)
+{
+    dispatch_cpu_isa(selected_cpu_isa(), f);
+}
+
+#endif // CPU_DISPATCH_H
@@ -0,0 +1,116 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <QImage>
+#include <QString>
+
+/*!
+ * \brief Saves images on background threads so the next map can integrate while the previous one is compressed.
+ *
+ * \details Images are saved with QImage::save exactly as a synchronous save would, so the files are byte for byte the same.
+ * The writer threads work through the queue in parallel, the position and time image of a map and the images of consecutive
+ * maps are compressed at the same time. The queue holds at most max_pending images, save blocks when it is full so a fast
+ * integration can not pile up unsaved maps in memory.
+ */
+class image_writer
+{
+public:
+    //! Start nthreads writer threads and queue at most max_pending images.
+    explicit image_writer(unsigned int nthreads = 2, std::size_t max_pending = 8);
+
+    //! Save the queued images and stop the writer threads.
+    ~image_writer();
+
+    image_writer(const image_writer &) = delete;
+    image_writer &operator=(const image_writer &) = delete;
+
+    //! Queue image to be saved as filename. If the image does not own its pixels, keep_alive must own them until the save is done.
+    void save(const QImage &image, const QString &filename, std::shared_ptr<void> keep_alive = nullptr);
+
+    //! Wait until every queued image is saved.
+    void wait();
+private:
+    struct save_job
+    {
+        QImage image;
+        QString filename;
+        std::shared_ptr<void> keep_alive;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::size_t m_max_pending;
+    std::mutex m_mutex; // guards the queue and counters below
+    std::condition_variable m_queued; // a job was queued or the writer stops
+    std::condition_variable m_saved; // a job finished
+    std::deque<save_job> m_jobs;
+    std::size_t m_in_progress = 0;
+    bool m_stop = false;
+
+    // writer thread loop
+    void writer();
+};
+
+inline image_writer::image_writer(unsigned int nthreads, std::size_t max_pending) : m_max_pending(std::max<std::size_t>(max_pending, 1))
+{
+    nthreads = std::max(nthreads, 1u);
+    for (unsigned int i = 0; i < nthreads; i++) {
+        m_threads.push_back(std::thread(&image_writer::writer, this));
+    }
+}
+
+inline image_writer::~image_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_queued.notify_all();
+    std::for_each(m_threads.begin(), m_threads.end(), [](std::thread& x){x.join();});
+}
+
+inline void image_writer::save(const QImage &image, const QString &filename, std::shared_ptr<void> keep_alive)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_saved.wait(lock, [this]() {return m_jobs.size() + m_in_progress < m_max_pending;});
+    m_jobs.push_back(save_job{image, filename, keep_alive});
+    lock.unlock();
+    m_queued.notify_one();
+}
+
+inline void image_writer::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_saved.wait(lock, [this]() {return m_jobs.empty() && m_in_progress == 0;});
+}
+
+inline void image_writer::writer()
+{
+    while (true) {
+        save_job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queued.wait(lock, [this]() {return m_stop || !m_jobs.empty();});
+            if (m_jobs.empty()) {
+                return; // stopping and nothing left to save
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_in_progress++;
+        }
+        job.image.save(job.filename);
+        job = save_job(); // release the pixels before reporting the save done
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_in_progress--;
+        }
+        m_saved.notify_all();
+    }
+}
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,81 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+#include "map_grid.h"
+#include "tile_scheduler.h"
+#include <chrono>
+
+/*!
+ * \brief Compile time switch of the integration instrumentation, define PENDULUM_INSTRUMENTATION to enable it.
+ *
+ * \details With instrumentation enabled the integration records the rejected steps of every point, the right hand side evaluations
+ * and the wall time and thread of every tile in map_statistics, which the map reports in its xml element and as a cost_map image.
+ * Disabled, the counters are never touched and the checks on this constant are removed by the compiler, so the hot paths are the
+ * same as without instrumentation.
+ */
+#ifdef PENDULUM_INSTRUMENTATION
+const bool instrumentation_enabled = true;
+#else
+const bool instrumentation_enabled = false;
+#endif
+
+/*!
+ * \brief Forwards the derivative calls of an integrator to a system and counts them.
+ *
+ * \details Integrators only call the system, so they are passed the counter in place of the system. Single and batch calls are both
+ * counted once, a batch call evaluates the derivative of every lane. The integrators are passed step_system(), which is the counter with
+ * instrumentation enabled and the system itself otherwise, so without instrumentation the integration compiles exactly as before and the
+ * count stays zero.
+ */
+template <typename system>
+class counting_system
+{
+public:
+    counting_system(const system &the_system) : m_system(the_system) {}
+
+    template <typename state, typename time>
+    void operator()(const state &x, state &dxdt, const time &t) const
+    {
+        if (instrumentation_enabled) {
+            m_count++;
+        }
+        m_system(x, dxdt, t);
+    }
+
+    //! Number of derivative calls so far.
+    unsigned long long count() const { return m_count; }
+
+    //! The system to pass to the integrators.
+#ifdef PENDULUM_INSTRUMENTATION
+    const counting_system &step_system() const { return *this; }
+#else
+    const system &step_system() const { return m_system; }
+#endif
+private:
+    const system &m_system;
+    mutable unsigned long long m_count = 0;
+};
+
+//! Run process_tile(tile, statistics) and with instrumentation enabled append the cost of the tile on thread thread_index to the statistics.
+template <typename tile_function>
+void instrumented_tile(const map_tile &tile, unsigned int thread_index, map_statistics &statistics, tile_function process_tile)
+{
+    if (!instrumentation_enabled) {
+        process_tile(tile, statistics);
+        return;
+    }
+    const unsigned long long rhs_evaluations = statistics.rhs_evaluations;
+    const unsigned long long rejected_steps = statistics.rejected_steps;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    process_tile(tile, statistics);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    tile_cost cost;
+    cost.tile = tile;
+    cost.thread_index = thread_index;
+    cost.seconds = elapsed.count();
+    cost.rhs_evaluations = statistics.rhs_evaluations - rhs_evaluations;
+    cost.rejected_steps = statistics.rejected_steps - rejected_steps;
+    statistics.tile_costs.push_back(cost);
+}
+
+#endif // INSTRUMENTATION_H
@@ -1,8 +1,16 @@
 //#include "map_tools.h"
 #include "pendulum_map.h"
+#include "map_sweep.h"
+#include "render_daemon.h"
+#include "thread_pool.h"
+#include "image_writer.h"
+#include "cpu_dispatch.h"
 #include "pendulum_system.h"
 #include "Integrators/rk4.h"
 #include "Integrators/ck45.h"
+#include "Integrators/bs32.h"
+#include "Integrators/dopri54.h"
+#include "Integrators/dop853.h"
 #include <iostream>
 #include <vector>
 #include <array>
@@ -10,18 +18,77 @@
 #include <chrono>
 #include <thread>
 #include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <limits>
 #include <QDomDocument>
 
 typedef std::array< double , 4 > state_type;
-int main()
+int main(int argc, char *argv[])
 {
-    typedef ck45 integrator_type;
+    typedef ck45 integrator_type; // bs32 is cheaper at loose tolerances, dop853 for tight tolerance reference maps
+
+    // --shard index count integrates one shard of every map (run one process per shard, on any machines sharing the directory),
+    // --merge count then saves the images and statistics of every map from the result files of its shards,
+    // --daemon socket serves render requests on a Unix socket instead with integrator_type (the default) and dop853, see render_daemon
+    unsigned int shard_index = 0;
+    unsigned int shard_count = 1;
+    unsigned int merge_count = 0;
+    QString daemon_socket;
+    // a whole decimal number that fits an unsigned int, anything else is a usage error
+    auto parse_unsigned = [](const char *text, unsigned int &value) {
+        char *end = nullptr;
+        errno = 0;
+        const unsigned long long parsed = std::strtoull(text, &end, 10);
+        if (end == text || *end != '\0' || errno == ERANGE || text[0] == '-' || parsed > std::numeric_limits<unsigned int>::max()) {
+            return false;
+        }
+        value = static_cast<unsigned int>(parsed);
+        return true;
+    };
+    for (int arg = 1; arg < argc; arg++) {
+        const std::string option = argv[arg];
+        if (option == "--shard" && arg + 2 < argc && parse_unsigned(argv[arg + 1], shard_index) && parse_unsigned(argv[arg + 2], shard_count)
+                && shard_index < shard_count) {
+            arg += 2;
+        } else if (option == "--merge" && arg + 1 < argc && parse_unsigned(argv[arg + 1], merge_count) && merge_count > 0) {
+            arg++;
+        } else if (option == "--daemon" && arg + 1 < argc) {
+            daemon_socket = argv[++arg];
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--shard index count | --merge count | --daemon socket]\n"
+                      << "       the shard index runs from 0 to count - 1, counts are at least 1\n";
+            return 1;
+        }
+    }
 
     std::chrono::time_point<std::chrono::system_clock> start, end;
     start = std::chrono::system_clock::now();
+    std::cout << "Integration kernels: " << cpu_isa_name(selected_cpu_isa()) << '\n'; // best instruction set path of this CPU, see dispatch_cpu_isa
     pendulum_system mysystem;
     integrator_type myintegrator;
+    thread_pool pool; // one worker per hardware thread, reused by every map
+    if (!daemon_socket.isEmpty()) {
+        // the pool and the tile cache stay warm across the requests of an exploration session
+        tile_cache render_cache("render_cache");
+        render_daemon<integrator_type, dop853> daemon(pool, &render_cache);
+        daemon.mapper<integrator_type>().set_batch_mode(true);
+        daemon.mapper<dop853>().set_batch_mode(true);
+        return daemon.run(daemon_socket) ? 0 : 1;
+    }
     pendulum_map<integrator_type> mymap;
+    mymap.set_thread_pool(&pool);
+    image_writer writer; // images are compressed in the background while the next map integrates
+    mymap.set_image_writer(&writer);
+    mymap.set_batch_mode(true);
+    mymap.set_result_file(true); // converge times, step counts and positions in result_map*.spmap, also the checkpoint a restarted run resumes from
+    mymap.set_checkpointing(true); // resume from the checkpointed tiles of an interrupted run, remove the result file to integrate a map again
+    if (!mymap.set_shard(shard_index, shard_count)) {
+        return 1;
+    }
+//    mymap.set_precision(integration_precision::mixed); // float derivatives, check the converge position differences with compare_precision first
+//    mymap.set_symmetry(true); // integrate only the points that are not mirror or rotation images of other points, the default attractors allow the x axis mirror, the sweep then saves its maps one after the other
 //    mysystem.clear_attractors();
 //    mysystem.add_attractor(0.5, 0.5);
 //    mysystem.add_attractor(-3.0, 3.0);
@@ -47,6 +114,8 @@ int main()
     QDomElement root = mydoc.createElement("Maps");
     mydoc.appendChild(root);
     QDomElement map_element;
+    // frames are integrated together by the sweep so threads never wait on the last tiles of a frame
+    map_sweep<integrator_type> sweep(mymap, myintegrator);
     for (int i = 0; i <= 0; i++) {
         if (i < 10) {
             count = "00" + QString::number(i);
@@ -58,8 +127,16 @@ int main()
 //        mysystem.b = 0.1 + i*0.0008;
         map_element = mydoc.createElement("map" + count);
         root.appendChild(map_element);
-        mymap.save_integrated_map(mysystem, myintegrator, count, map_element);
+        if (merge_count > 0) {
+            mymap.merge_shards(count, merge_count, map_element);
+        } else {
+            sweep.add_map(mysystem, count, map_element);
+        }
+    }
+    if (merge_count == 0) {
+        sweep.run();
     }
+    writer.wait();
     end = std::chrono::system_clock::now();
     std::chrono::duration<double> elapsed_seconds = end-start;
     std::cout << "\nTotal elapsed time: " << elapsed_seconds.count() << "s.\n";
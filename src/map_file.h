@@ -0,0 +1,553 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <QFile>
+#include <QString>
+#ifdef __unix__
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+#include "map_grid.h"
+#include "tile_scheduler.h"
+#include "pendulum_system.h"
+
+//! Statistics of the run that wrote a result file, the map_statistics counters without the per thread and per tile instrumentation.
+struct map_file_statistics
+{
+    std::uint64_t total_count = 0;
+    std::uint64_t mid_converge_count = 0;
+    std::uint64_t outside_bounds_count = 0;
+    std::uint64_t total_steps = 0;
+    std::uint64_t filled_count = 0;
+    std::uint64_t verified_count = 0;
+    std::uint64_t verify_mismatch_count = 0;
+    std::uint64_t cache_hit_count = 0;
+    std::uint64_t cache_agree_count = 0;
+    std::uint64_t restored_count = 0;
+    std::uint64_t reused_count = 0;
+    std::uint64_t symmetry_count = 0;
+    std::uint64_t rejected_steps = 0;
+    std::uint64_t rhs_evaluations = 0;
+    std::uint64_t max_rejected_steps = 0;
+    double total_integration_time = 0.0;
+    double max_time = 0.0;
+
+    //! The counters as map_statistics.
+    map_statistics statistics() const;
+
+    //! Record of the counters of statistics.
+    static map_file_statistics from_statistics(const map_statistics &statistics);
+};
+
+/*!
+ * \brief Fixed size header at the start of a result file, describes the grid, the system and the settings the map was integrated with.
+ *
+ * \details Every field is naturally aligned and the struct has no padding, so the header is read by mapping the file and casting
+ * its first bytes. Files are written in the byte order of the machine, byte_order reads 0x01020304 when the reader has the same order.
+ */
+struct map_file_header
+{
+    char magic[8] = {'S', 'P', 'M', 'A', 'P', '\0', '\0', '\0'};
+    std::uint32_t version = 4;
+    std::uint32_t byte_order = 0x01020304;
+    std::uint64_t attractor_offset = 0; // byte offset of the attractor_count map_file_attractor records
+    std::uint64_t tile_state_offset = 0; // byte offset of one byte per tile, 1 once the tile is checkpointed
+    std::uint64_t data_offset = 0; // byte offset of the first tile, page aligned
+
+    std::uint32_t xdim = 0;
+    std::uint32_t ydim = 0;
+    std::int32_t x_factor = 0; // the point with x index i starts at (x_factor + i)*resolution, see map_grid::start_state
+    std::int32_t y_factor = 0;
+    double resolution = 0.0;
+
+    std::uint32_t tile_width = 0;
+    std::uint32_t tile_height = 0;
+    std::uint32_t tiles_x = 0;
+    std::uint32_t tiles_y = 0;
+    std::uint32_t attractor_count = 0;
+    std::uint32_t complete = 0; // set to 1 after the last tile is written
+
+    double d = 0.0; // pendulum_system parameters
+    double m = 0.0;
+    double g = 0.0;
+    double b = 0.0;
+    double L = 0.0;
+
+    double start_time = 0.0; // pendulum_map settings
+    double step_size = 0.0;
+    double position_tolerance = 0.0;
+    double mid_position_tolerance = 0.0;
+    double time_tolerance = 0.0;
+    std::uint32_t flags = 0; // map_file_* bits below
+    std::uint32_t shard_index = 0; // the file holds the tiles of shard shard_index of shard_count, see pendulum_map::set_shard
+    std::uint32_t shard_count = 1;
+    std::uint32_t reserved = 0;
+
+    char integrator_name[16] = {}; // integrator settings, tolerances are 0 for fixed step integrators
+    double relative_tolerance = 0.0;
+    double absolute_tolerance = 0.0;
+    double max_step_size = 0.0;
+
+    double computation_time = 0.0; // seconds spent on the map, set by finish and summed over resumed runs
+    map_file_statistics statistics; // statistics of the last run, set by finish, a resumed run counts the restored points again
+};
+
+static_assert(sizeof(map_file_header) == 368, "map_file_header must not contain padding");
+
+//! Bits of map_file_header::flags recording how the map was integrated.
+const std::uint32_t map_file_batch_mode = 1;
+const std::uint32_t map_file_boundary_tracing = 2;
+const std::uint32_t map_file_energy_policy = 4;
+const std::uint32_t map_file_convergence_cache = 8; // points could stop early on a convergence_cache hit
+const std::uint32_t map_file_pi_controller = 16; // the integrator used its proportional integral step size controller
+const std::uint32_t map_file_automatic_initial_step = 32; // points started with the step size estimated by the integrator
+const std::uint32_t map_file_mixed_precision = 64; // derivatives evaluated in float, see integration_precision
+const std::uint32_t map_file_symmetry = 128; // points filled from their symmetric images, see pendulum_map::symmetric_integrate_map
+const std::uint32_t map_file_isa_avx2 = 256; // batch step run on the AVX2 path, whose FMA arithmetic differs from the baseline path, see cpu_isa
+const std::uint32_t map_file_isa_avx512 = 512; // batch step run on the AVX-512 path
+
+//! Attractor record of a result file.
+struct map_file_attractor
+{
+    double x;
+    double y;
+    double k;
+};
+
+//! Point record of a result file, the converge time in single precision as point_type holds it and the step count and converge position of point_type packed in one word.
+struct map_file_point
+{
+    float converge_time;
+    std::uint32_t packed; // step count in the low 24 bits, converge position (255 outside bounds, 254 middle) in the high 8 bits
+
+    std::uint32_t step_count() const { return packed & 0xffffff; }
+    std::uint32_t converge_position() const { return packed >> 24; }
+
+    //! The point as it is stored in a map_grid.
+    point_type point() const;
+
+    //! Record of the_point.
+    static map_file_point from_point(const point_type &the_point);
+};
+
+/*!
+ * \brief Writes the integration results of a map to a tiled binary result file while the map is integrated.
+ *
+ * \details The file holds a map_file_header, the attractor table and then the point records tile by tile, in the order of
+ * tile_scheduler for the tile size in the header. Every tile is stored as a full tile_width by tile_height block, row by row starting at
+ * its lowest y index, with the points beyond the map edge stored as unset points (converge position 255). The file is sized up front and
+ * each finished tile is written to its own place, so tiles can be written by any thread in any order and the results never have to be
+ * held in memory for the whole map. The header is marked complete by finish.
+ *
+ * The file doubles as a checkpoint. Every checkpoint_interval seconds the written tiles are synced to disk and then marked in the tile
+ * state table, so a tile is only marked once its points are on disk and a checkpoint survives a crash of the machine. A writer created with resume on an existing file of the same map
+ * (identical header apart from the complete flag and identical attractors) keeps the marked tiles, read_tile restores them into the
+ * grid and only the missing tiles have to be integrated again. Otherwise the file is recreated.
+ *
+ * The grids passed in may cover only part of the map, such as a band of rows, as long as their tiles are tiles of the file tiling.
+ * Their position in the map is taken from their x and y factors. The file of one shard of a sharded map has the size of the whole map
+ * but only the tiles of the shard are written and marked, the others are never touched and take no disk space on sparse file systems.
+ */
+class map_file_writer
+{
+public:
+    //! Create filename for a map described by header (tiling and offsets are set here) with the attractors of the_system, or continue it if resume is set and it holds a checkpoint of the same map.
+    map_file_writer(const QString &filename, map_file_header header, const pendulum_system &the_system, bool resume = false, double checkpoint_interval = 10.0);
+
+    map_file_writer(const map_file_writer &) = delete;
+    map_file_writer &operator=(const map_file_writer &) = delete;
+
+    //! True if the file was created.
+    bool is_open() const { return m_file.isOpen(); }
+
+    //! The header written to the file.
+    const map_file_header &header() const { return m_header; }
+
+    //! Number of tiles restored from a checkpoint when the file was opened.
+    unsigned int resumed_tile_count() const { return m_resumed_tile_count; }
+
+    //! True if the points of tile of the_map were restored from a checkpoint and can be read with read_tile instead of integrating them.
+    bool has_tile(const map_grid &the_map, const map_tile &tile) const;
+
+    //! Store the checkpointed points of tile in the_map and add them to statistics, thread safe.
+    void read_tile(map_grid &the_map, const map_tile &tile, map_statistics &statistics);
+
+    //! Write the points of a finished tile of the_map, thread safe. The tile must be one of the tiles of the file tiling. Starts a checkpoint when the checkpoint interval has passed.
+    void write_tile(const map_grid &the_map, const map_tile &tile);
+
+    //! Checkpoint the remaining tiles, add computation_time to the time stored in the header, store statistics in it, mark the file complete and close it.
+    void finish(double computation_time, const map_statistics &statistics);
+private:
+    QFile m_file;
+    map_file_header m_header;
+    std::mutex m_mutex; // one seek and write at a time
+    std::vector<unsigned char> m_tile_state; // tile state table as in the file
+    std::vector<std::uint64_t> m_pending_tiles; // written tiles that are not marked yet
+    std::chrono::steady_clock::time_point m_last_checkpoint;
+    std::chrono::duration<double> m_checkpoint_interval;
+    unsigned int m_resumed_tile_count = 0;
+
+    // index in the file tiling of tile of the_map
+    std::uint64_t tile_index(const map_grid &the_map, const map_tile &tile) const;
+
+    // byte offset of the records of a tile
+    std::uint64_t tile_offset(std::uint64_t index) const;
+
+    // true if the file is a checkpoint of the map described by m_header with attractors, loads its tile state table
+    bool open_checkpoint(const std::vector<map_file_attractor> &attractors);
+
+    // sync the written tiles to disk and mark them in the tile state table, m_mutex must be held
+    void checkpoint();
+
+    // flush the file buffer and wait until the operating system has written the file to disk
+    void sync_file();
+};
+
+/*!
+ * \brief Read only view of a result file, mapped into memory so the points are read in place without loading the file.
+ *
+ * \details Only the pages that are accessed are read from disk, so tools can scan maps larger than memory. The records are
+ * returned as pointers into the mapping and stay valid while the reader exists.
+ */
+class map_file_reader
+{
+public:
+    //! Map filename, is_open is false if it can not be mapped or is not a result file of this version and byte order.
+    explicit map_file_reader(const QString &filename);
+
+    map_file_reader(const map_file_reader &) = delete;
+    map_file_reader &operator=(const map_file_reader &) = delete;
+
+    bool is_open() const { return m_data != nullptr; }
+
+    const map_file_header &header() const { return *reinterpret_cast<const map_file_header *>(m_data); }
+
+    //! The attractor table, header().attractor_count records.
+    const map_file_attractor *attractors() const { return reinterpret_cast<const map_file_attractor *>(m_data + header().attractor_offset); }
+
+    //! First point record of tile (tile_x, tile_y), tile_width by tile_height records row by row starting at its lowest y index.
+    const map_file_point *tile(unsigned int tile_x, unsigned int tile_y) const;
+
+    //! Point record of the point with x index i and y index j.
+    const map_file_point &point(unsigned int i, unsigned int j) const;
+
+    //! True if tile (tile_x, tile_y) was written, always true for complete files that are not a shard of a map.
+    bool has_tile(unsigned int tile_x, unsigned int tile_y) const { return m_data[header().tile_state_offset + std::size_t(tile_y)*header().tiles_x + tile_x] != 0; }
+private:
+    QFile m_file;
+    const unsigned char *m_data = nullptr;
+};
+
+//! True if the result files a and b hold the same map and attractors, they may be different shards of it and differ in completion, computation time and statistics.
+inline bool same_map_file(const map_file_reader &a, const map_file_reader &b)
+{
+    map_file_header a_header = a.header();
+    map_file_header b_header = b.header();
+    a_header.shard_index = b_header.shard_index;
+    a_header.complete = b_header.complete;
+    a_header.computation_time = b_header.computation_time;
+    a_header.statistics = b_header.statistics;
+    return std::memcmp(&a_header, &b_header, sizeof(a_header)) == 0
+            && std::memcmp(a.attractors(), b.attractors(), a_header.attractor_count*sizeof(map_file_attractor)) == 0;
+}
+
+//! Size of a result file in bytes for header.
+inline std::uint64_t map_file_size(const map_file_header &header)
+{
+    return header.data_offset + std::uint64_t(header.tiles_x)*header.tiles_y*header.tile_width*header.tile_height*sizeof(map_file_point);
+}
+
+//! Copy the name and tolerances of integrators that report them (see ck45) into header.
+template <typename integrator_type>
+auto set_map_file_integrator(map_file_header &header, const integrator_type &the_integrator, int)
+    -> decltype(the_integrator.relative_tolerance(), void())
+{
+    std::strncpy(header.integrator_name, integrator_type::name(), sizeof(header.integrator_name)-1);
+    header.relative_tolerance = the_integrator.relative_tolerance();
+    header.absolute_tolerance = the_integrator.absolute_tolerance();
+    header.max_step_size = the_integrator.max_step_size();
+}
+
+//! Copy the name of fixed step integrators (see rk4) into header.
+template <typename integrator_type>
+void set_map_file_integrator(map_file_header &header, const integrator_type &, long)
+{
+    std::strncpy(header.integrator_name, integrator_type::name(), sizeof(header.integrator_name)-1);
+}
+
+inline point_type map_file_point::point() const
+{
+    point_type the_point;
+    the_point.converge_time = converge_time;
+    the_point.step_count = step_count();
+    the_point.converge_position = converge_position();
+    return the_point;
+}
+
+inline map_file_point map_file_point::from_point(const point_type &the_point)
+{
+    return map_file_point{the_point.converge_time, std::uint32_t(the_point.step_count) | (std::uint32_t(the_point.converge_position) << 24)};
+}
+
+inline map_statistics map_file_statistics::statistics() const
+{
+    map_statistics the_statistics;
+    the_statistics.total_count = total_count;
+    the_statistics.mid_converge_count = mid_converge_count;
+    the_statistics.outside_bounds_count = outside_bounds_count;
+    the_statistics.total_integration_time = total_integration_time;
+    the_statistics.total_steps = total_steps;
+    the_statistics.max_time = max_time;
+    the_statistics.filled_count = filled_count;
+    the_statistics.verified_count = verified_count;
+    the_statistics.verify_mismatch_count = verify_mismatch_count;
+    the_statistics.cache_hit_count = cache_hit_count;
+    the_statistics.cache_agree_count = cache_agree_count;
+    the_statistics.restored_count = restored_count;
+    the_statistics.reused_count = reused_count;
+    the_statistics.symmetry_count = symmetry_count;
+    the_statistics.rejected_steps = rejected_steps;
+    the_statistics.rhs_evaluations = rhs_evaluations;
+    the_statistics.max_rejected_steps = max_rejected_steps;
+    return the_statistics;
+}
+
+inline map_file_statistics map_file_statistics::from_statistics(const map_statistics &statistics)
+{
+    map_file_statistics record;
+    record.total_count = statistics.total_count;
+    record.mid_converge_count = statistics.mid_converge_count;
+    record.outside_bounds_count = statistics.outside_bounds_count;
+    record.total_steps = statistics.total_steps;
+    record.filled_count = statistics.filled_count;
+    record.verified_count = statistics.verified_count;
+    record.verify_mismatch_count = statistics.verify_mismatch_count;
+    record.cache_hit_count = statistics.cache_hit_count;
+    record.cache_agree_count = statistics.cache_agree_count;
+    record.restored_count = statistics.restored_count;
+    record.reused_count = statistics.reused_count;
+    record.symmetry_count = statistics.symmetry_count;
+    record.rejected_steps = statistics.rejected_steps;
+    record.rhs_evaluations = statistics.rhs_evaluations;
+    record.max_rejected_steps = statistics.max_rejected_steps;
+    record.total_integration_time = statistics.total_integration_time;
+    record.max_time = statistics.max_time;
+    return record;
+}
+
+inline map_file_writer::map_file_writer(const QString &filename, map_file_header header, const pendulum_system &the_system, bool resume, double checkpoint_interval)
+    : m_file(filename), m_header(header), m_last_checkpoint(std::chrono::steady_clock::now()), m_checkpoint_interval(checkpoint_interval)
+{
+    const std::uint64_t page_size = 4096;
+    m_header.tile_width = std::max(m_header.tile_width, 1u);
+    m_header.tile_height = std::max(m_header.tile_height, 1u);
+    m_header.tiles_x = (m_header.xdim + m_header.tile_width - 1)/m_header.tile_width;
+    m_header.tiles_y = (m_header.ydim + m_header.tile_height - 1)/m_header.tile_height;
+    m_header.attractor_count = the_system.attractor_list().size();
+    m_header.attractor_offset = sizeof(map_file_header);
+    m_header.tile_state_offset = m_header.attractor_offset + m_header.attractor_count*sizeof(map_file_attractor);
+    m_header.data_offset = (m_header.tile_state_offset + std::uint64_t(m_header.tiles_x)*m_header.tiles_y + page_size - 1)/page_size*page_size;
+    m_header.complete = 0;
+
+    std::vector<map_file_attractor> attractors;
+    for (const auto &the_attractor : the_system.attractor_list()) {
+        attractors.push_back(map_file_attractor{the_attractor.x, the_attractor.y, the_attractor.k});
+    }
+    if (resume && QFile::exists(filename) && open_checkpoint(attractors)) {
+        return;
+    }
+
+    m_tile_state.assign(std::size_t(m_header.tiles_x)*m_header.tiles_y, 0);
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        return;
+    }
+    m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+    m_file.write(reinterpret_cast<const char *>(attractors.data()), attractors.size()*sizeof(map_file_attractor));
+    m_file.write(reinterpret_cast<const char *>(m_tile_state.data()), m_tile_state.size());
+    m_file.resize(map_file_size(m_header));
+}
+
+inline bool map_file_writer::open_checkpoint(const std::vector<map_file_attractor> &attractors)
+{
+    if (!m_file.open(QIODevice::ReadWrite) || std::uint64_t(m_file.size()) != map_file_size(m_header)) {
+        m_file.close();
+        return false;
+    }
+    map_file_header file_header;
+    std::vector<map_file_attractor> file_attractors(attractors.size());
+    m_tile_state.assign(std::size_t(m_header.tiles_x)*m_header.tiles_y, 0);
+    m_file.seek(0);
+    m_file.read(reinterpret_cast<char *>(&file_header), sizeof(file_header));
+    m_file.read(reinterpret_cast<char *>(file_attractors.data()), file_attractors.size()*sizeof(map_file_attractor));
+    m_file.read(reinterpret_cast<char *>(m_tile_state.data()), m_tile_state.size());
+    file_header.complete = 0;
+    // a resumed map keeps the time of the runs before, its statistics are replaced by finish
+    m_header.computation_time = file_header.computation_time;
+    m_header.statistics = file_header.statistics;
+    if (std::memcmp(&file_header, &m_header, sizeof(m_header)) != 0
+            || std::memcmp(file_attractors.data(), attractors.data(), attractors.size()*sizeof(map_file_attractor)) != 0) {
+        m_file.close();
+        return false;
+    }
+    // the file stays incomplete until finish, whatever it was before
+    m_file.seek(offsetof(map_file_header, complete));
+    m_file.write(reinterpret_cast<const char *>(&m_header.complete), sizeof(m_header.complete));
+    m_resumed_tile_count = std::count(m_tile_state.begin(), m_tile_state.end(), 1);
+    return true;
+}
+
+inline std::uint64_t map_file_writer::tile_index(const map_grid &the_map, const map_tile &tile) const
+{
+    const unsigned int x_begin = tile.x_begin + (the_map.x_factor() - m_header.x_factor);
+    const unsigned int y_begin = tile.y_begin + (the_map.y_factor() - m_header.y_factor);
+    return std::uint64_t(y_begin/m_header.tile_height)*m_header.tiles_x + x_begin/m_header.tile_width;
+}
+
+inline std::uint64_t map_file_writer::tile_offset(std::uint64_t index) const
+{
+    return m_header.data_offset + index*m_header.tile_width*m_header.tile_height*sizeof(map_file_point);
+}
+
+inline bool map_file_writer::has_tile(const map_grid &the_map, const map_tile &tile) const
+{
+    return m_resumed_tile_count > 0 && m_tile_state[tile_index(the_map, tile)] != 0;
+}
+
+inline void map_file_writer::read_tile(map_grid &the_map, const map_tile &tile, map_statistics &statistics)
+{
+    std::vector<map_file_point> records(std::size_t(m_header.tile_width)*m_header.tile_height);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file.seek(tile_offset(tile_index(the_map, tile)));
+        m_file.read(reinterpret_cast<char *>(records.data()), records.size()*sizeof(map_file_point));
+    }
+    for (unsigned int j = tile.y_begin; j < tile.y_end; j++) {
+        const map_file_point *row = &records[std::size_t(j - tile.y_begin)*m_header.tile_width];
+        for (unsigned int i = tile.x_begin; i < tile.x_end; i++) {
+            const point_type the_point = row[i - tile.x_begin].point();
+            the_map.set_point(the_map.index(i, j), the_point);
+            statistics.add_point(the_point);
+        }
+    }
+    statistics.restored_count += (tile.x_end - tile.x_begin)*(tile.y_end - tile.y_begin);
+}
+
+inline void map_file_writer::write_tile(const map_grid &the_map, const map_tile &tile)
+{
+    if (!is_open()) {
+        return;
+    }
+    // points outside the map keep the unset record so every tile has the same size
+    const map_file_point unset_point{0.0f, std::uint32_t(255) << 24};
+    std::vector<map_file_point> records(std::size_t(m_header.tile_width)*m_header.tile_height, unset_point);
+    for (unsigned int j = tile.y_begin; j < tile.y_end; j++) {
+        map_file_point *row = &records[std::size_t(j - tile.y_begin)*m_header.tile_width];
+        for (unsigned int i = tile.x_begin; i < tile.x_end; i++) {
+            const point_type &the_point = the_map[the_map.index(i, j)];
+            row[i - tile.x_begin] = map_file_point::from_point(the_point);
+        }
+    }
+    const std::uint64_t index = tile_index(the_map, tile);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.seek(tile_offset(index));
+    m_file.write(reinterpret_cast<const char *>(records.data()), records.size()*sizeof(map_file_point));
+    m_pending_tiles.push_back(index);
+    if (std::chrono::steady_clock::now() - m_last_checkpoint >= m_checkpoint_interval) {
+        checkpoint();
+    }
+}
+
+inline void map_file_writer::checkpoint()
+{
+    m_last_checkpoint = std::chrono::steady_clock::now();
+    if (m_pending_tiles.empty()) {
+        return;
+    }
+    // the points go out before the marks, a run killed in between only loses the unmarked tiles
+    sync_file();
+    const auto range = std::minmax_element(m_pending_tiles.begin(), m_pending_tiles.end());
+    const std::uint64_t first = *range.first;
+    const std::uint64_t last = *range.second;
+    for (const std::uint64_t index : m_pending_tiles) {
+        m_tile_state[index] = 1;
+    }
+    m_pending_tiles.clear();
+    m_file.seek(m_header.tile_state_offset + first);
+    m_file.write(reinterpret_cast<const char *>(&m_tile_state[first]), last - first + 1);
+    sync_file();
+}
+
+inline void map_file_writer::sync_file()
+{
+    m_file.flush();
+#ifdef __unix__
+    ::fsync(m_file.handle());
+#elif defined(_WIN32)
+    ::_commit(m_file.handle());
+#endif
+}
+
+inline void map_file_writer::finish(double computation_time, const map_statistics &statistics)
+{
+    if (!is_open()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    checkpoint();
+    m_header.complete = 1;
+    m_header.computation_time += computation_time;
+    m_header.statistics = map_file_statistics::from_statistics(statistics);
+    m_file.seek(offsetof(map_file_header, complete));
+    m_file.write(reinterpret_cast<const char *>(&m_header.complete), sizeof(m_header.complete));
+    m_file.seek(offsetof(map_file_header, computation_time));
+    m_file.write(reinterpret_cast<const char *>(&m_header.computation_time), sizeof(m_header.computation_time));
+    m_file.seek(offsetof(map_file_header, statistics));
+    m_file.write(reinterpret_cast<const char *>(&m_header.statistics), sizeof(m_header.statistics));
+    sync_file();
+    m_file.close();
+}
+
+inline map_file_reader::map_file_reader(const QString &filename) : m_file(filename)
+{
+    if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < qint64(sizeof(map_file_header))) {
+        return;
+    }
+    const unsigned char *data = m_file.map(0, m_file.size());
+    if (data == nullptr) {
+        return;
+    }
+    const map_file_header &file_header = *reinterpret_cast<const map_file_header *>(data);
+    const map_file_header expected;
+    if (std::memcmp(file_header.magic, expected.magic, sizeof(expected.magic)) != 0 || file_header.version != expected.version
+            || file_header.byte_order != expected.byte_order || std::uint64_t(m_file.size()) < map_file_size(file_header)) {
+        return;
+    }
+    m_data = data;
+}
+
+inline const map_file_point *map_file_reader::tile(unsigned int tile_x, unsigned int tile_y) const
+{
+    const map_file_header &file_header = header();
+    const std::uint64_t tile_size = std::uint64_t(file_header.tile_width)*file_header.tile_height;
+    const std::uint64_t tile_index = std::uint64_t(tile_y)*file_header.tiles_x + tile_x;
+    return reinterpret_cast<const map_file_point *>(m_data + file_header.data_offset) + tile_index*tile_size;
+}
+
+inline const map_file_point &map_file_reader::point(unsigned int i, unsigned int j) const
+{
+    const map_file_header &file_header = header();
+    const map_file_point *tile_points = tile(i/file_header.tile_width, j/file_header.tile_height);
+    return tile_points[std::size_t(j%file_header.tile_height)*file_header.tile_width + i%file_header.tile_width];
+}
+
+#endif // MAP_FILE_H
@@ -0,0 +1,229 @@
+#ifndef MAP_GRID_H
+#define MAP_GRID_H
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include "tile_scheduler.h"
+
+typedef std::array< double , 4 > state_type;
+
+//! Compact integration result for a point: converge time in single precision, integration step count and converge position as an attractor index.
+struct point_type
+{
+    float converge_time;
+    unsigned int step_count : 24; // integrations stop after 1000000 steps so 24 bits are enough
+    unsigned int converge_position : 8; // 255 reserved for points that do not converge, 254 for points that converge to the middle
+
+    point_type() : converge_time(0.0f), step_count(0), converge_position(255) {}
+};
+
+//! Wall time and work of one integrated tile, recorded with instrumentation enabled (see instrumentation.h).
+struct tile_cost
+{
+    map_tile tile;
+    unsigned int thread_index = 0;
+    double seconds = 0.0;
+    unsigned long long rhs_evaluations = 0;
+    unsigned long long rejected_steps = 0;
+};
+
+//! General information about an integrated map, accumulated per thread while integrating and merged afterwards.
+struct map_statistics
+{
+    unsigned int total_count = 0;
+    unsigned int mid_converge_count = 0;
+    unsigned int outside_bounds_count = 0;
+    double total_integration_time = 0.0;
+    unsigned long long total_steps = 0;
+    double max_time = 0.0;
+    unsigned int filled_count = 0; // points filled by boundary tracing without integrating them, not part of the counts, times and steps above
+    unsigned int verified_count = 0; // filled points integrated anyway to check the fill
+    unsigned int verify_mismatch_count = 0; // verified points that converged somewhere other than the fill
+    unsigned int cache_hit_count = 0; // points that reached a cell known to the convergence cache
+    unsigned int cache_agree_count = 0; // cache hits whose prediction matched full integration (cache verification only)
+    unsigned int restored_count = 0; // points restored from a checkpoint instead of integrating them
+    unsigned int reused_count = 0; // points reused from the tile cache instead of integrating them
+    unsigned int symmetry_count = 0; // points filled from a symmetric point instead of integrating them
+    std::vector<thread_timing> thread_timings; // busy and idle time of each thread of a parallel integration
+    unsigned long long rejected_steps = 0; // integrator steps rejected by the error control (instrumentation only)
+    unsigned long long rhs_evaluations = 0; // derivative evaluations, a batch evaluation counts once per point in it (instrumentation only)
+    unsigned int max_rejected_steps = 0; // most rejected steps of a single point (instrumentation only)
+    std::vector<tile_cost> tile_costs; // cost of every integrated tile (instrumentation only)
+
+    //! Add the result of one point to the statistics.
+    void add_point(const point_type &the_point);
+
+    //! Add the statistics of another part of the map.
+    void merge(const map_statistics &other);
+
+    //! Average converge time of the points that did not go outside bounds.
+    double avg_integration_time() const;
+
+    //! Average step count of the points that did not go outside bounds.
+    double avg_step_count() const;
+};
+
+//! Allocator whose value construction leaves the memory untouched, so the pages of a buffer are first touched (and placed on the NUMA node of) the thread that initializes them.
+template <typename T>
+struct first_touch_allocator : std::allocator<T>
+{
+    template <typename U>
+    struct rebind
+    {
+        typedef first_touch_allocator<U> other;
+    };
+
+    first_touch_allocator() {}
+
+    template <typename U>
+    first_touch_allocator(const first_touch_allocator<U> &) {}
+
+    template <typename U>
+    void construct(U *) {}
+
+    template <typename U, typename... Args>
+    void construct(U *pointer, Args&&... args)
+    {
+        ::new(static_cast<void *>(pointer)) U(std::forward<Args>(args)...);
+    }
+};
+
+/*!
+ * \brief Contiguous row-major grid of point results for a map.
+ *
+ * \details Points are addressed by their x index i and y index j, where (0, 0) is the lower left (x start, y start) corner of the map.
+ * Rows are stored from the top of the map (largest y) down, which is the memory order QImage expects, so the position and time image
+ * buffers are written directly as points finish and saving the map needs no extra copy. Start states are not stored, they are computed
+ * from the grid index on demand. A grid can be created uninitialized and initialized in row ranges by the threads that will use it.
+ */
+class map_grid
+{
+public:
+    map_grid() {}
+
+    //! Create a grid of xdim by ydim points starting at (x_factor*resolution, y_factor*resolution), without initialize the points must be set up with initialize_rows before use.
+    map_grid(unsigned int xdim, unsigned int ydim, int x_factor, int y_factor, double resolution, bool initialize = true);
+
+    //! Reset the points of memory rows [row_begin, row_end) to unset points, the rows are in image order (top of the map first).
+    void initialize_rows(unsigned int row_begin, unsigned int row_end);
+
+    unsigned int xdim() const { return m_xdim; }
+    unsigned int ydim() const { return m_ydim; }
+    std::size_t size() const { return m_points.size(); }
+    int x_factor() const { return m_x_factor; }
+    int y_factor() const { return m_y_factor; }
+    double resolution() const { return m_res; }
+
+    //! Memory index of the point with x index i and y index j.
+    std::size_t index(unsigned int i, unsigned int j) const;
+
+    //! Start state of the point with x index i and y index j, at rest at its grid position.
+    state_type start_state(unsigned int i, unsigned int j) const;
+
+    //! Store the result for a point and write its position and time image pixels.
+    void set_point(std::size_t index, const point_type &the_point);
+
+    const point_type &operator[](std::size_t index) const { return m_points[index]; }
+
+    //! Indexed 8 bit image buffer of converge positions in image order.
+    unsigned char *position_image() { return m_position_image.data(); }
+
+    //! Indexed 8 bit image buffer of converge times rounded to integers in image order.
+    unsigned char *time_image() { return m_time_image.data(); }
+private:
+    unsigned int m_xdim = 0;
+    unsigned int m_ydim = 0;
+    int m_x_factor = 0; // int multipliers of the resolution for the first column and row, avoids floating math rounding error
+    int m_y_factor = 0;
+    double m_res = 0.0;
+    std::vector<point_type, first_touch_allocator<point_type>> m_points;
+    std::vector<unsigned char, first_touch_allocator<unsigned char>> m_position_image;
+    std::vector<unsigned char, first_touch_allocator<unsigned char>> m_time_image;
+};
+
+inline void map_statistics::add_point(const point_type &the_point)
+{
+    max_time = std::max(max_time, double(the_point.converge_time));
+    if (the_point.converge_position == 255) {
+        outside_bounds_count++;
+    } else {
+        total_count++;
+        total_integration_time += the_point.converge_time;
+        total_steps += the_point.step_count;
+        if (the_point.converge_position == 254) {
+            mid_converge_count++;
+        }
+    }
+}
+
+inline void map_statistics::merge(const map_statistics &other)
+{
+    total_count += other.total_count;
+    mid_converge_count += other.mid_converge_count;
+    outside_bounds_count += other.outside_bounds_count;
+    total_integration_time += other.total_integration_time;
+    total_steps += other.total_steps;
+    max_time = std::max(max_time, other.max_time);
+    filled_count += other.filled_count;
+    verified_count += other.verified_count;
+    verify_mismatch_count += other.verify_mismatch_count;
+    cache_hit_count += other.cache_hit_count;
+    cache_agree_count += other.cache_agree_count;
+    restored_count += other.restored_count;
+    reused_count += other.reused_count;
+    symmetry_count += other.symmetry_count;
+    rejected_steps += other.rejected_steps;
+    rhs_evaluations += other.rhs_evaluations;
+    max_rejected_steps = std::max(max_rejected_steps, other.max_rejected_steps);
+    tile_costs.insert(tile_costs.end(), other.tile_costs.begin(), other.tile_costs.end());
+}
+
+inline double map_statistics::avg_integration_time() const
+{
+    return total_integration_time/double(total_count);
+}
+
+inline double map_statistics::avg_step_count() const
+{
+    return double(total_steps)/double(total_count);
+}
+
+inline map_grid::map_grid(unsigned int xdim, unsigned int ydim, int x_factor, int y_factor, double resolution, bool initialize)
+    : m_xdim(xdim), m_ydim(ydim), m_x_factor(x_factor), m_y_factor(y_factor), m_res(resolution),
+      m_points(std::size_t(xdim)*ydim), m_position_image(std::size_t(xdim)*ydim), m_time_image(std::size_t(xdim)*ydim)
+{
+    if (initialize) {
+        initialize_rows(0, ydim);
+    }
+}
+
+inline void map_grid::initialize_rows(unsigned int row_begin, unsigned int row_end)
+{
+    const std::size_t begin = std::size_t(row_begin)*m_xdim;
+    const std::size_t end = std::size_t(row_end)*m_xdim;
+    std::fill(m_points.begin() + begin, m_points.begin() + end, point_type());
+    std::fill(m_position_image.begin() + begin, m_position_image.begin() + end, 255);
+    std::fill(m_time_image.begin() + begin, m_time_image.begin() + end, 0);
+}
+
+inline std::size_t map_grid::index(unsigned int i, unsigned int j) const
+{
+    return std::size_t(m_ydim-1-j)*m_xdim + i;
+}
+
+inline state_type map_grid::start_state(unsigned int i, unsigned int j) const
+{
+    return state_type{{double(m_x_factor + int(i))*m_res, double(m_y_factor + int(j))*m_res, 0.0, 0.0}};
+}
+
+inline void map_grid::set_point(std::size_t index, const point_type &the_point)
+{
+    m_points[index] = the_point;
+    m_position_image[index] = the_point.converge_position;
+    m_time_image[index] = int(std::round(the_point.converge_time));
+}
+
+#endif // MAP_GRID_H
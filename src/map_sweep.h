@@ -0,0 +1,154 @@
+#ifndef MAP_SWEEP_H
+#define MAP_SWEEP_H
+#include "pendulum_map.h"
+#include "pendulum_system.h"
+#include "tile_scheduler.h"
+#include "map_file.h"
+#include "instrumentation.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <QString>
+#include <QDomDocument>
+
+/*!
+ * \brief Integrates a list of maps that differ only in their pendulum_system parameters, such as the frames of an animation sweep.
+ *
+ * \details Calling pendulum_map::save_integrated_map for each frame leaves threads idle while the last tiles of every map finish.
+ * The sweep instead schedules the tiles of all maps on one set of worker threads, map by map, so threads that run out of tiles
+ * of one map continue with the next map. A map grid is created when its first tile is taken and saved (images and xml attributes as
+ * save_integrated_map writes them, and the result file when enabled) by the thread that finishes its last tile, so only the maps in flight are held in memory.
+ * The map settings (ranges, resolution, tolerances, tile size, thread count or pool, modes, shard) are taken from the pendulum_map passed in.
+ */
+template <typename integrator_type>
+class map_sweep
+{
+public:
+    //! Create a sweep that integrates its maps with the settings of the_mapper and the_integrator, both are copied.
+    map_sweep(const pendulum_map<integrator_type> &the_mapper, const integrator_type &the_integrator);
+
+    //! Add a map for the_system, its images are saved with filename and its statistics written to xml_element.
+    void add_map(const pendulum_system &the_system, QString filename, QDomElement xml_element);
+
+    //! Integrate and save all added maps, returns the busy and idle time of each thread over the whole sweep. Streamed and symmetric maps (see pendulum_map::set_streaming and pendulum_map::set_symmetry) are saved one after the other by pendulum_map::save_integrated_map and no timings are returned.
+    std::vector<thread_timing> run();
+private:
+    // one map of the sweep, its grid and statistics live from its first tile to its last
+    struct sweep_map
+    {
+        pendulum_system system;
+        QString filename;
+        QDomElement xml_element;
+        map_type grid;
+        std::unique_ptr<map_file_writer> result_file; // nullptr unless the mapper writes result files
+        map_statistics statistics;
+        unsigned int remaining_tiles = 0;
+        std::chrono::steady_clock::time_point start;
+        std::once_flag created;
+        std::mutex mutex;
+    };
+
+    pendulum_map<integrator_type> m_mapper;
+    integrator_type m_integrator;
+    std::vector<std::unique_ptr<sweep_map>> m_maps;
+    std::mutex m_output_mutex; // the xml document and console are shared by all maps
+
+    // integrate one tile of a map, creating the map on its first tile and saving it after its last
+    void process_tile(const map_tile &tile, unsigned int thread_index);
+};
+
+template <typename integrator_type>
+map_sweep<integrator_type>::map_sweep(const pendulum_map<integrator_type> &the_mapper, const integrator_type &the_integrator)
+    : m_mapper(the_mapper), m_integrator(the_integrator)
+{
+}
+
+template <typename integrator_type>
+void map_sweep<integrator_type>::add_map(const pendulum_system &the_system, QString filename, QDomElement xml_element)
+{
+    std::unique_ptr<sweep_map> the_map(new sweep_map);
+    the_map->system = the_system;
+    the_map->filename = filename;
+    the_map->xml_element = xml_element;
+    m_maps.push_back(std::move(the_map));
+}
+
+template <typename integrator_type>
+std::vector<thread_timing> map_sweep<integrator_type>::run()
+{
+    if (m_mapper.streaming() || m_mapper.symmetric_save()) {
+        // a streamed map already keeps its memory bounded and a symmetric map fills its images only once its fundamental domain is
+        // integrated, the maps are integrated one after the other
+        for (auto &the_map : m_maps) {
+            m_mapper.save_integrated_map(the_map->system, m_integrator, the_map->filename, the_map->xml_element);
+        }
+        return std::vector<thread_timing>();
+    }
+
+    // every map has the same grid dimensions
+    unsigned int xdim;
+    unsigned int ydim;
+    {
+        const map_type grid_shape = m_mapper.create_map_container();
+        xdim = grid_shape.xdim();
+        ydim = grid_shape.ydim();
+    }
+    tile_scheduler scheduler(xdim, ydim, m_mapper.tile_width(), m_mapper.tile_height(), m_maps.size());
+    const unsigned int tiles_per_map = m_maps.empty() ? 0 : scheduler.tiles().size()/m_maps.size();
+    for (auto &the_map : m_maps) {
+        the_map->remaining_tiles = tiles_per_map;
+    }
+
+    auto run_tile = [&](const map_tile &tile, unsigned int thread_index) {process_tile(tile, thread_index);};
+    thread_pool *pool = m_mapper.shared_thread_pool();
+    const std::vector<thread_timing> timings = pool != nullptr ? scheduler.run(*pool, run_tile) : scheduler.run(m_mapper.thread_count(), run_tile);
+
+    double busy_time = 0.0;
+    double idle_time = 0.0;
+    for (const auto &timing : timings) {
+        busy_time += timing.busy_time;
+        idle_time += timing.idle_time;
+    }
+    const double utilization = busy_time + idle_time > 0.0 ? busy_time/(busy_time + idle_time) : 1.0;
+    std::cout << "\nSweep of " << m_maps.size() << " maps on " << timings.size() << " threads, thread utilization " << utilization << '\n';
+    return timings;
+}
+
+template <typename integrator_type>
+void map_sweep<integrator_type>::process_tile(const map_tile &tile, unsigned int thread_index)
+{
+    sweep_map &the_map = *m_maps[tile.map_index];
+    std::call_once(the_map.created, [&]() {
+        the_map.grid = m_mapper.create_map_container();
+        the_map.result_file = m_mapper.create_result_file(the_map.system, m_integrator, the_map.grid, the_map.filename);
+        the_map.start = std::chrono::steady_clock::now();
+    });
+
+    map_statistics tile_statistics;
+    instrumented_tile(tile, thread_index, tile_statistics, [&](const map_tile &the_tile, map_statistics &statistics) {
+        m_mapper.integrate_map_tile(m_integrator, the_map.system, the_map.grid, the_tile, statistics, the_map.result_file.get());
+    });
+
+    bool last_tile;
+    {
+        std::lock_guard<std::mutex> lock(the_map.mutex);
+        the_map.statistics.merge(tile_statistics);
+        last_tile = (--the_map.remaining_tiles == 0);
+    }
+    if (last_tile) {
+        const std::chrono::duration<double> elapsed_seconds = std::chrono::steady_clock::now() - the_map.start;
+        if (the_map.result_file) {
+            the_map.result_file->finish(elapsed_seconds.count(), the_map.statistics);
+            the_map.result_file.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_output_mutex);
+            m_mapper.save_map_results(std::move(the_map.grid), the_map.statistics, elapsed_seconds.count(), the_map.filename, the_map.xml_element);
+        }
+        the_map.grid = map_type(); // the finished map is released once its images are saved
+    }
+}
+
+#endif // MAP_SWEEP_H
@@ -1,258 +1,1961 @@
 #ifndef PENDULUM_MAP_H
 #define PENDULUM_MAP_H
 #include "pendulum_system.h"
+#include "tile_scheduler.h"
+#include "map_grid.h"
+#include "convergence_cache.h"
+#include "thread_pool.h"
+#include "image_writer.h"
+#include "map_file.h"
+#include "tile_cache.h"
+#include "instrumentation.h"
+#include "cpu_dispatch.h"
+#include "Integrators/step_controller.h"
+#include <string>
+#include <memory>
 #include <vector>
 #include <cmath>
 #include <iostream>
 #include <array>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
 #include <QImage>
 #include <QDomDocument>
 #include <QString>
 #include <QVector>
+#include <QFile>
 
 typedef std::array< double , 4 > state_type;
-//! Container for a point, stores the start state, converge position as an attractor index, converge time, and integration step count.
-struct point_type
+typedef map_grid map_type;
+
+//! Detects integrators that provide a lockstep do_batch_step (see ck45::do_batch_step), others are integrated point by point in batch mode.
+template <typename integrator_type, typename = void>
+struct has_batch_step : std::false_type {};
+
+template <typename integrator_type>
+struct has_batch_step<integrator_type, decltype(std::declval<const integrator_type &>().do_batch_step(std::declval<const pendulum_system &>(),
+                                                                                                    std::declval<batch_state_type<batch_lanes> &>(),
+                                                                                                    std::declval<std::array<double, batch_lanes> &>(),
+                                                                                                    std::declval<std::array<double, batch_lanes> &>(),
+                                                                                                    std::declval<std::array<int, batch_lanes> &>()))> : std::true_type {};
+
+//! Detects integrators whose do_step carries the derivative from one step to the next (see fsal_rk), pendulum_map keeps it per point.
+template <typename integrator_type, typename = void>
+struct has_fsal_step : std::false_type {};
+
+template <typename integrator_type>
+struct has_fsal_step<integrator_type, decltype(std::declval<const integrator_type &>().do_step(std::declval<const pendulum_system &>(),
+                                                                                               std::declval<state_type &>(),
+                                                                                               std::declval<state_type &>(),
+                                                                                               std::declval<double &>(),
+                                                                                               std::declval<double &>()), void())> : std::true_type {};
+
+//! Detects integrators with a selectable step size controller (see ck45), their do_step also takes the controller and the error of the previous accepted step.
+template <typename integrator_type, typename = void>
+struct has_step_controller : std::false_type {};
+
+template <typename integrator_type>
+struct has_step_controller<integrator_type, decltype(std::declval<const integrator_type &>().do_step(std::declval<const pendulum_system &>(),
+                                                                                                     std::declval<state_type &>(),
+                                                                                                     std::declval<double &>(),
+                                                                                                     std::declval<double &>(),
+                                                                                                     step_controller::integral,
+                                                                                                     std::declval<double &>()), void())> : std::true_type {};
+
+//! Detects integrators that estimate the first step size of a trajectory (see ck45::initial_step).
+template <typename integrator_type, typename = void>
+struct has_initial_step : std::false_type {};
+
+template <typename integrator_type>
+struct has_initial_step<integrator_type, decltype(std::declval<const integrator_type &>().initial_step(std::declval<const pendulum_system &>(),
+                                                                                                      std::declval<const state_type &>(),
+                                                                                                      0.0), void())> : std::true_type {};
+
+/*!
+ * \brief Step memory of a point or a batch of points, the state integrators carry from one step of a trajectory to the next.
+ *
+ * \details That is the derivative of FSAL integrators and the error of the previous accepted step of integrators with a step size
+ * controller, which is used with the controller the memory is created with. start and start_lane set up the memory for a point starting
+ * at a state, do_step and do_batch_step step through it. For other integrators the memory is empty and the steps are the plain
+ * integrator steps.
+ */
+template <typename integrator_type, bool fsal = has_fsal_step<integrator_type>::value, bool controlled = has_step_controller<integrator_type>::value>
+class step_memory
 {
-    state_type start_state;
-    int converge_position = 255; // 255 reserved for points that do not converge
-    double converge_time = 0.0;
-    unsigned int step_count = 0;
+public:
+    explicit step_memory(step_controller) {}
+
+    template <typename system>
+    void start(const system &, const state_type &, double) {}
+
+    template <typename system>
+    void start_lane(const system &, const state_type &, double, std::size_t) {}
+
+    template <typename system>
+    int do_step(const integrator_type &the_integrator, const system &the_system, state_type &x, double &t, double &h)
+    {
+        return the_integrator.do_step(the_system, x, t, h);
+    }
+
+    template <typename system, typename lane_array, typename lane_mask>
+    void do_batch_step(const integrator_type &the_integrator, const system &the_system, batch_state_type<batch_lanes> &x, lane_array &t, lane_array &h, lane_mask &accepted)
+    {
+        the_integrator.do_batch_step(the_system, x, t, h, accepted);
+    }
 };
 
-typedef std::vector< std::vector<point_type> > map_type;
-typedef std::vector< std::vector<point_type> >::iterator map_iter;
+template <typename integrator_type>
+class step_memory<integrator_type, true, false>
+{
+public:
+    explicit step_memory(step_controller) {}
+
+    template <typename system>
+    void start(const system &the_system, const state_type &x, double t)
+    {
+        the_system(x, m_dxdt, t);
+    }
+
+    template <typename system>
+    void start_lane(const system &the_system, const state_type &x, double t, std::size_t lane)
+    {
+        state_type dxdt;
+        the_system(x, dxdt, t);
+        for (std::size_t i = 0; i < dxdt.size(); i++) {
+            m_batch_dxdt[i][lane] = dxdt[i];
+        }
+    }
+
+    template <typename system>
+    int do_step(const integrator_type &the_integrator, const system &the_system, state_type &x, double &t, double &h)
+    {
+        return the_integrator.do_step(the_system, x, m_dxdt, t, h);
+    }
+
+    template <typename system, typename lane_array, typename lane_mask>
+    void do_batch_step(const integrator_type &the_integrator, const system &the_system, batch_state_type<batch_lanes> &x, lane_array &t, lane_array &h, lane_mask &accepted)
+    {
+        the_integrator.do_batch_step(the_system, x, m_batch_dxdt, t, h, accepted);
+    }
+private:
+    state_type m_dxdt;
+    batch_state_type<batch_lanes> m_batch_dxdt;
+};
+
+template <typename integrator_type>
+class step_memory<integrator_type, false, true>
+{
+public:
+    explicit step_memory(step_controller controller) : m_controller(controller) {}
+
+    template <typename system>
+    void start(const system &, const state_type &, double)
+    {
+        m_previous_error = 1.0;
+    }
+
+    template <typename system>
+    void start_lane(const system &, const state_type &, double, std::size_t lane)
+    {
+        m_batch_previous_error[lane] = 1.0;
+    }
+
+    template <typename system>
+    int do_step(const integrator_type &the_integrator, const system &the_system, state_type &x, double &t, double &h)
+    {
+        if (m_controller == step_controller::integral) {
+            return the_integrator.do_step(the_system, x, t, h);
+        }
+        return the_integrator.do_step(the_system, x, t, h, m_controller, m_previous_error);
+    }
+
+    template <typename system, typename lane_array, typename lane_mask>
+    void do_batch_step(const integrator_type &the_integrator, const system &the_system, batch_state_type<batch_lanes> &x, lane_array &t, lane_array &h, lane_mask &accepted)
+    {
+        if (m_controller == step_controller::integral) {
+            the_integrator.do_batch_step(the_system, x, t, h, accepted);
+            return;
+        }
+        the_integrator.do_batch_step(the_system, x, t, h, accepted, m_controller, m_batch_previous_error);
+    }
+private:
+    step_controller m_controller;
+    double m_previous_error = 1.0;
+    std::array<double, batch_lanes> m_batch_previous_error;
+};
+
+//! Rule pendulum_map uses to decide that a point has converged.
+enum class convergence_policy
+{
+    dwell, //!< the head stayed near the same attractor (or the middle) for the time tolerance
+    energy //!< additionally converged as soon as the head is near an attractor with less energy than the potential barrier around it, damped systems only. A heuristic: the attractor forces are not conservative (see pendulum_system::potential_energy), so a head below the barrier can still escape, check the agreement with compare_convergence_policies before using it
+};
+
+//! Precision of the derivative evaluations of pendulum_map, the integrators always step the state in double.
+enum class integration_precision
+{
+    double_precision, //!< derivatives in double
+    mixed //!< derivatives in float through fixed_pendulum_system<N, float>, systems with more than max_fixed_attractor_count attractors stay in double
+};
 
 //! Class used to integrate points and maps for the pendulum system.
 
 
 template <typename integrator_type>
-class pendulum_map
+class pendulum_map
+{
+public:
+    pendulum_map();
+
+    //! Parallel integrate and save colored map of convergence and grayscale map of integration time as a png, file name is of the form position_map*filename*.png and time_map*filename*.png (without the asterisks). With set_result_file the points are also written to result_map*filename*.spmap as their tiles finish.
+    void save_integrated_map(pendulum_system &the_system, integrator_type &the_integrator, QString filename, QDomElement xml_element) const;
+
+    /*!
+     * \brief Integrate the map progressively from coarse to fine and save the images of every level as it completes, returns the finest completed level.
+     *
+     * \details Level l holds the points whose x and y indices are multiples of 2^l, the map at 2^l times the resolution. The coarsest level
+     * levels-1 is integrated first, each finer level then integrates only the points that are not on the lattice of the level before, so
+     * every point is integrated once and a quick coarse answer comes first. The images and statistics of a level are saved with
+     * save_map_results as position_map*filename*_level*l*.png and time_map*filename*_level*l*.png and written to a level child of
+     * xml_element. With a positive time_budget in seconds no tiles of the finer levels are started after the budget has run out, the level
+     * in progress is dropped and the finest completed level is returned. The coarsest level is always finished, so a budget shorter than
+     * the coarsest level still returns that level. Boundary tracing is not used in this mode.
+     */
+    int save_progressive_map(const pendulum_system &the_system, const integrator_type &the_integrator, QString filename, QDomElement xml_element, unsigned int levels, double time_budget = 0.0) const;
+
+    //! Save the images of an integrated map and write its statistics and computation time to xml_element and the console, the output half of save_integrated_map. With an image writer the map is kept alive until its images are saved in the background. A shard (see set_shard) only writes its statistics.
+    void save_map_results(map_type integration_map, const map_statistics &statistics, double computation_time, QString filename, QDomElement xml_element) const;
+
+    //! Indexed position image of the_map in the attractor colors, it uses the pixel buffer of the_map and is valid while the_map is.
+    QImage position_image(map_type &the_map) const;
+
+    //! Indexed grayscale converge time image of the_map for a map whose longest converge time is max_time, it uses the pixel buffer of the_map and is valid while the_map is.
+    QImage time_image(map_type &the_map, double max_time) const;
+
+    /*!
+     * \brief Assemble the images and statistics of a map integrated as shard_count shards (see set_shard) from the result files of the shards, returns false if a shard file is missing, incomplete or of another map.
+     *
+     * \details The tiles are taken from the shard that owns them and saved with save_map_results as save_integrated_map would save the
+     * unsharded map. The statistics are the sums of the statistics each shard stored in its file, so the fill, cache and step counters
+     * are those of the runs that integrated the shards. The computation time is the longest shard time, the time the map takes when every shard runs at once, and the
+     * summed and per shard times are written to xml_element as well. The grid dimensions and resolution are taken from the files, the
+     * colors and image writer from this map.
+     */
+    bool merge_shards(QString filename, unsigned int shard_count, QDomElement xml_element) const;
+
+    //! Integrate one tile of the map the way save_integrated_map integrates the whole map, by boundary tracing when it is enabled and point by point otherwise. With a result file the tile is restored from it if it was checkpointed and written to it after integrating otherwise. Tiles of other shards (see set_shard) are left as they are.
+    void integrate_map_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics, map_file_writer *result_file = nullptr) const;
+
+    //! Parallel integrate the map, splits the map into tiles that are handed out to the threads on demand and integrated by pendulum_map::integrate_tile. Returns the map statistics reduced from the threads along with the busy and idle time of each thread. With set_symmetry the map is integrated by symmetric_integrate_map.
+    map_statistics parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const;
+
+    /*!
+     * \brief Parallel integrate only the points of the map that are not images of other points under the symmetries of the attractors (see pendulum_system::symmetries) and fill the others from them.
+     *
+     * \details A point is filled from the point with the lowest index among the grid points that a symmetry maps onto it, with the
+     * attractor index of that point permuted by the symmetry, and integrated if there is none. Symmetries that do not map it onto a
+     * grid point of the map, such as rotations by a third turn on the square grid or parts of the map without a mirror image in its
+     * ranges, are skipped for the point, so such points are integrated. Every point is integrated or filled from an integrated point in
+     * two parallel passes. Filled points keep the converge time and step count of their source and are counted in statistics.symmetry_count,
+     * the fill of a point whose trajectory runs along a basin boundary can differ from its own integration by rounding. With a result file
+     * every tile is written after the fill, checkpointed tiles are integrated again.
+     */
+    map_statistics symmetric_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map, map_file_writer *result_file = nullptr) const;
+
+    //! Parallel integrate the map by boundary tracing, each tile is integrated by pendulum_map::boundary_integrate_tile. Returns the map statistics along with the busy and idle time of each thread and the counts of filled and verified points.
+    map_statistics boundary_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const;
+
+    //! Integrate a single point from its start state and stop after converging to an attractor or the middle, stores the converge position, time and step count in the_point. Convergence cache hits are counted in statistics if given. The steps use the fixed_pendulum_system of the system when there is one, see dispatch_attractor_count.
+    void integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const state_type &start_state, point_type &the_point, map_statistics *statistics = nullptr) const;
+
+    //! Integrate the map with the dwell and the energy convergence policy, print and add to xml_element the time each took, their average step counts and the fraction of points both classify the same. Returns the energy policy statistics.
+    map_statistics compare_convergence_policies(const pendulum_system &the_system, const integrator_type &the_integrator, QDomElement xml_element) const;
+
+    //! Integrate the map in double and in mixed precision, print and add to xml_element the time each took, their average step counts and the fraction of points whose converge position differs. Returns the mixed precision statistics.
+    map_statistics compare_precision(const pendulum_system &the_system, const integrator_type &the_integrator, QDomElement xml_element) const;
+
+    //! Create the result file result_map*filename*.spmap for the_map (see map_file_writer) if result files are enabled or the map is sharded, nullptr otherwise. With resume enabled the checkpointed tiles of an earlier run of the same map are kept. Set symmetric if the map is filled by symmetric_integrate_map, the header records it.
+    std::unique_ptr<map_file_writer> create_result_file(const pendulum_system &the_system, const integrator_type &the_integrator, const map_type &the_map, QString filename, bool symmetric = false) const;
+
+    //! Create a map of type map_type (row-major grid of point_type) for the current x-y ranges and resolution. With a thread pool (called outside its workers) the rows are initialized in bands by the pool workers so the pages are first touched by the workers.
+    map_type create_map_container() const;
+
+    //! Integrate the points of one tile of the map, writes the results and image pixels into the map and adds them to statistics.
+    void integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const;
+
+    /*!
+     * \brief Integrate the points of one tile of the map by boundary tracing (Mariani-Silver subdivision).
+     *
+     * \details Only the border of a rectangle is integrated. If every border point converges to the same attractor (or the middle) the
+     * interior is filled with that converge position without integrating it, its converge times and step counts are interpolated from the
+     * border and kept within the converge times of the border. Filled points are only counted in statistics.filled_count, the averages
+     * and the longest converge time of the statistics are those of the integrated points. Otherwise the rectangle is split into four quarters sharing their inner edges and each quarter is traced the same way, so
+     * integrations concentrate along the basin boundaries. Rectangles are only filled when all of their points lie inside the pendulum
+     * length boundary and they do not contain (0,0). Basins narrower than the subdivision can be missed, the verification fraction of
+     * pendulum_map::set_boundary_tracing integrates a sample of the filled points to measure how often that happens.
+     */
+    void boundary_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const;
+
+    //! Integrate a point with a fixed integration time.
+    void fixed_integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const state_type &start_state, point_type &the_point) const;
+
+    //! Integrate the points of one tile of the map with a fixed integration time.
+    void fixed_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const;
+
+    //! Parallel integrate the map with a fixed integration time. Returns the map statistics along with the busy and idle time of each thread.
+    map_statistics fixed_parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const;
+
+    // basic property modifiers for the map, integration and colors for attractors NOTE: must have a color assigned for each attractor or the image will not form correctly
+    //! Set the x and y start and end positions and the resolution.
+    void set_map(double x_start_position, double x_end_position, double y_start_position, double y_end_position, double resolution);
+
+    //! Set the converge tolerance for stopping the integration.
+    void set_converge_tol(double position_tolerance, double mid_position_tolerance, double time_tolerance);
+
+    //! Set the thread count for parallel integration, threads are started for every map unless a thread pool is set.
+    void set_thread_count(unsigned int nthreads);
+
+    //! Set a persistent thread pool (owned by the caller) to integrate maps on instead of starting threads for each map, nullptr to go back to the thread count.
+    void set_thread_pool(thread_pool *pool);
+
+    //! Set an image writer (owned by the caller) that saves the map images in the background, nullptr to save them before save_integrated_map returns. Call image_writer::wait before using the files.
+    void set_image_writer(image_writer *writer);
+
+    //! Set whether save_integrated_map and map_sweep also write the point results (converge time, step count and converge position as the map holds them in point_type, the time in single precision) to a tiled binary result file, see map_file_writer.
+    void set_result_file(bool result_file);
+
+    bool writes_result_file() const { return m_result_file; }
+
+    //! Set whether a run continues from the checkpointed tiles of an existing result file of the same map (off by default, restored tiles are reported) and how often, in seconds, written tiles are checkpointed.
+    void set_checkpointing(bool resume, double checkpoint_interval = 10.0);
+
+    /*!
+     * \brief Integrate only shard shard_index of shard_count of every map, so independent processes (on one or many machines) can share a map, see merge_shards.
+     *
+     * \details The tiles of the map are dealt to the shards round robin in tile order, tile k belongs to shard k modulo shard_count. The
+     * expensive regions of a map span many tiles, so every shard gets a similar share of them, and the assignment depends only on the map
+     * and tile size. A shard writes its tiles to result_map*filename*_shard*index*of*count*.spmap whether or not result files are enabled,
+     * checkpointed and resumed like any result file, and reports its statistics without saving images. Applies to save_integrated_map
+     * (streaming included) and map_sweep, a shard_count of 1 turns sharding off. Returns false and keeps the current shard if shard_count
+     * is 0 or shard_index is not below it.
+     */
+    bool set_shard(unsigned int shard_index, unsigned int shard_count);
+
+    unsigned int shard_count() const { return m_shard_count; }
+
+    //! The thread pool set by set_thread_pool or nullptr.
+    thread_pool *shared_thread_pool() const { return m_pool; }
+
+    unsigned int thread_count() const { return m_pool != nullptr ? m_pool->size() : m_nthreads; }
+    unsigned int tile_width() const { return m_tile_width; }
+    unsigned int tile_height() const { return m_tile_height; }
+
+    //! Set the width and height in points of the tiles the map is split into for parallel integration.
+    void set_tile_size(unsigned int tile_width, unsigned int tile_height);
+
+    //! Set the initial step size for the integrator.
+    void set_step_size(double step_size);
+
+    //! Set whether pendulum_map::integrate_tile advances points in lockstep batches of batch_lanes points, a lane is refilled with the next point as soon as its point finishes.
+    void set_batch_mode(bool batch_mode);
+
+    //! Set the step size controller of integrators that offer a choice (see ck45), the integral controller by default.
+    void set_step_controller(step_controller controller);
+
+    //! Set whether every point starts with the first step size the integrator estimates for it (see ck45::initial_step) instead of the step size, for integrators that estimate one.
+    void set_automatic_initial_step(bool automatic_initial_step);
+
+    /*!
+     * \brief Set whether save_integrated_map streams the map in bands of band_height rows (rounded up to whole tiles) instead of holding the whole map in memory.
+     *
+     * \details Each band is integrated on the threads, written to the result file and its position image rows appended to position_map*filename*.ppm,
+     * then released, so memory use depends on the map width and band height only. The grayscale time_map*filename*.pgm needs the max converge time
+     * of the whole map for its scale and is written in a second pass over the memory mapped result file. The result file is always written in this mode.
+     * Netpbm images are written because they can be written row by row, map_sweep integrates streamed maps one after the other.
+     */
+    void set_streaming(bool streaming, unsigned int band_height = 256);
+
+    bool streaming() const { return m_streaming; }
+
+    //! Set whether save_integrated_map uses boundary tracing (see boundary_integrate_tile), verify_fraction of the filled points are integrated anyway and checked against the fill. Larger tiles (set_tile_size) skip more points.
+    void set_boundary_tracing(bool boundary_tracing, double verify_fraction = 0.0);
+
+    //! Set whether parallel_integrate_map and save_integrated_map integrate only the points that are not symmetric images of other points (see symmetric_integrate_map), with attractor positions and strengths compared within tolerance. save_integrated_map integrates every point with boundary tracing, a tile cache, shards or streaming, map_sweep saves symmetric maps one after the other.
+    void set_symmetry(bool symmetry, double tolerance = 1e-9);
+
+    //! True if save_integrated_map fills the map by symmetry, set_symmetry without boundary tracing, a tile cache or shards. Streaming is checked by the caller.
+    bool symmetric_save() const { return m_symmetry && !m_boundary_tracing && m_tile_cache == nullptr && m_shard_count <= 1; }
+
+    //! Set the rule for deciding a point has converged, see convergence_policy. The default is convergence_policy::dwell, the energy policy is a heuristic.
+    void set_convergence_policy(convergence_policy policy);
+
+    //! Set the precision of the derivative evaluations, see integration_precision. Use compare_precision to check what mixed precision changes on a map.
+    void set_precision(integration_precision precision);
+
+    //! Set the instruction set path of the batch mode step, limited to selected_cpu_isa() which is the default, see dispatch_cpu_isa. Paths other than the baseline give different results and are recorded in result files and the tile cache key.
+    void set_cpu_isa(cpu_isa isa);
+
+    //! Set a convergence cache shared by the threads (nullptr to disable), points stop as soon as they reach a known cell. With verify_cache the points are integrated to the end and the cache prediction is only compared with the result. Cells are kept per system, integrator and convergence settings (see convergence_cache_owner), so one cache can serve maps of different systems.
+    void set_convergence_cache(convergence_cache *cache, bool verify_cache = false);
+
+    //! Set an on-disk tile cache (owned by the caller, nullptr to disable) that save_integrated_map and map_sweep take points from instead of integrating them and add new points to, see tile_cache.
+    void set_tile_cache(tile_cache *cache);
+
+    //! Set the end integration time (only used for fixed time integration).
+    void set_end_time(double end_time);
+
+    //! Set the color for an attractor by its index.
+    void set_attractor_color(int index, int r, int g, int b);
+
+    //! Add a color to the attractor color table.
+    void add_attractor_color(int r, int g, int b);
+
+    //! Clear the color table.
+    void clear_attractor_colors();
+
+    //! Set the color for points outside bounds.
+    void set_no_converge_color(int r, int g, int b);
+
+    //! Set the color for points that converge to the middle.
+    void set_mid_converge_color(int r, int g, int b);
+private:
+    double m_res = 0.05; // resolution of the map
+    double m_xstart = -10.0; // start and end points for the map
+    double m_ystart = -10.0;
+    double m_xend = 10.0;
+    double m_yend = 10.0;
+    double m_tstart = 0.0; // starting integration time
+    double m_tend = 20.0; // end integration time (only used for fixed integrations)
+    double m_dt = 0.001; // starting integration step size
+    unsigned int m_tile_width = 16; // tile size in points for parallel integration
+    unsigned int m_tile_height = 16;
+    unsigned int m_nthreads = std::max(std::thread::hardware_concurrency(), 1u); // number of threads
+    thread_pool *m_pool = nullptr; // persistent worker threads, not owned
+    image_writer *m_image_writer = nullptr; // background image saving, not owned
+    bool m_result_file = false; // write a binary result file next to the images
+    bool m_resume = false; // continue from the checkpointed tiles of an existing result file
+    double m_checkpoint_interval = 10.0; // seconds between result file checkpoints
+    unsigned int m_shard_index = 0; // the shard of every map integrated by this process
+    unsigned int m_shard_count = 1;
+    bool m_streaming = false; // integrate and save the map band by band
+    unsigned int m_band_height = 256; // rows per band in streaming mode
+    double m_pos_tol = 0.5; // position tolerance for checking magnet convergence
+    double m_mid_tol = 0.1; // position tolerance for checking mid/gravity convergence
+    double m_time_tol = 5.0; // time tolerance for checking convergence
+    QVector<QRgb> attractor_colors; // index of colors to be assigned to the attractors
+    QRgb no_converge_color = qRgb(255, 255, 255); // color for points that are outside bounds or do not converge to the middle or attractors
+    QRgb mid_converge_color = qRgb(0, 0, 0); // color for points that converge to the middle
+    bool m_batch_mode = false; // integrate points in lockstep batches when the integrator supports it
+    step_controller m_step_controller = step_controller::integral;
+    bool m_automatic_initial_step = false; // start points with the step size estimated by the integrator instead of m_dt
+    convergence_policy m_policy = convergence_policy::dwell; // rule for deciding a point has converged
+    integration_precision m_precision = integration_precision::double_precision; // precision of the derivative evaluations
+    cpu_isa m_cpu_isa = selected_cpu_isa(); // instruction set path the batch mode step is run with
+    bool m_boundary_tracing = false; // integrate only tile borders and fill uniform regions
+    bool m_symmetry = false; // fill the symmetric images of integrated points
+    double m_symmetry_tolerance = 1e-9; // attractor position and strength tolerance of the symmetries
+    double m_verify_fraction = 0.0; // fraction of boundary traced fill points that are integrated to check the fill
+    convergence_cache *m_cache = nullptr; // shared convergence cache, not owned
+    bool m_verify_cache = false; // only compare cache predictions with full integration
+    static const unsigned int cache_interval = 4; // trials between convergence cache lookups
+    tile_cache *m_tile_cache = nullptr; // on-disk cache of integrated points, not owned
+
+    // find the point (source_i, source_j) of the map that the symmetry maps onto point (i, j) and fills it, returns false if (i, j) is integrated itself
+    bool symmetric_source(const std::vector<attractor_symmetry> &symmetries, const map_type &the_map, unsigned int i, unsigned int j, unsigned int &source_i, unsigned int &source_j, const attractor_symmetry *&symmetry) const;
+
+    // integrate the grid points returned by next_point(i, j) until it returns false, storing the results in the map and statistics
+    template <typename point_source>
+    void integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, point_source next_point, map_statistics &statistics) const;
+
+    // call f with the step system for the_system in the map precision, see dispatch_attractor_count
+    template <typename function>
+    void dispatch_step_system(const pendulum_system &the_system, function &&f) const;
+
+    // true if dispatch_step_system evaluates the derivatives of the_system in float, only fixed_pendulum_system has a float version
+    bool float_derivatives(const pendulum_system &the_system) const;
+
+    // trap circle of the energy policy around a converge position and the potential barrier on it
+    struct energy_trap
+    {
+        double radius;
+        double barrier;
+    };
+
+    // energy policy traps of the_system indexed by converge position with the middle last, empty when the energy policy is off
+    std::vector<energy_trap> energy_traps(const pendulum_system &the_system) const;
+
+    // integrate_point with the integrator stepping step_system, the_system or its fixed_pendulum_system, the_system is used for the convergence checks, traps are its energy_traps and cache_owner its convergence_cache_owner (0 without a convergence cache)
+    template <typename step_system_type>
+    void integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, const state_type &start_state, point_type &the_point, map_statistics *statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner) const;
+
+    // lockstep batch integration of the grid points returned by next_point stepping step_system, the false_type overload is used for integrators without do_batch_step. cache_owner is the convergence_cache_owner of the map, 0 without a convergence cache
+    template <typename step_system_type, typename point_source>
+    void batch_integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, map_type &the_map, point_source next_point, map_statistics &statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner, std::true_type) const;
+    template <typename step_system_type, typename point_source>
+    void batch_integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, map_type &the_map, point_source next_point, map_statistics &statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner, std::false_type) const;
+
+    // split the map into tiles (tile_scale times the tile size in each direction), run tile_function(tile, statistics) on each of them in parallel and reduce the per thread statistics
+    template <typename tile_function>
+    map_statistics parallel_tiles(map_type &the_map, tile_function process_tile, unsigned int tile_scale = 1) const;
+
+    // integrate the points of a tile on the lattice of the level with stride, skipping the points on the lattice of the next coarser level if reuse is set
+    void integrate_level_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, unsigned int stride, bool reuse, map_statistics &statistics) const;
+
+    // save_integrated_map in streaming mode
+    void stream_integrated_map(const pendulum_system &the_system, const integrator_type &the_integrator, QString filename, QDomElement xml_element) const;
+
+    // write the grayscale time image of a streamed map row by row from its result file
+    void stream_time_image(QString filename, double max_time) const;
+
+    // write the statistics and computation time of a map to xml_element and the console
+    void report_map_statistics(const map_statistics &statistics, double computation_time, QDomElement xml_element) const;
+
+    // dimensions and int multipliers of the resolution for the first column and row of the map for the current x-y ranges and resolution
+    void map_dimensions(unsigned int &xdim, unsigned int &ydim, int &x_factor, int &y_factor) const;
+
+    // create the result file for an xdim by ydim map starting at (x_factor, y_factor) times the resolution, symmetric for a map filled by symmetric_integrate_map
+    std::unique_ptr<map_file_writer> open_result_file(const pendulum_system &the_system, const integrator_type &the_integrator, unsigned int xdim, unsigned int ydim, int x_factor, int y_factor, QString filename, bool symmetric = false) const;
+
+    // name of the result file of the map filename, or of shard shard_index of shard_count of it
+    static QString result_filename(QString filename, unsigned int shard_index = 0, unsigned int shard_count = 1);
+
+    // true if tile of the_map belongs to the shard of this process
+    bool in_shard(const map_type &the_map, const map_tile &tile) const;
+
+    // result file header with everything but the grid dimensions and factors
+    map_file_header result_file_header(const pendulum_system &the_system, const integrator_type &the_integrator) const;
+
+    // integrate the points of a tile that are not in the tile cache and add them to the cache
+    void cached_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const;
+
+    // print the busy and idle time of each thread and add them to the xml element as thread elements with utilization summary attributes
+    void report_thread_timings(const std::vector<thread_timing> &timings, QDomElement xml_element) const;
+
+    // print and write the instrumentation counters and the cost of the tiles and threads to the xml element
+    void report_instrumentation(const map_statistics &statistics, QDomElement xml_element) const;
+
+    // save a heat map of the integration time per point of every tile, black for the cheapest tiles to white for the most expensive
+    void save_cost_image(const std::vector<tile_cost> &tile_costs, unsigned int xdim, unsigned int ydim, QString filename) const;
+
+    // radius of the circle the energy policy traps the head in around a converge position (attractor index or 254 for the middle) and the lowest potential energy on it
+    double trap_barrier(const pendulum_system &the_system, int position, double &radius) const;
+
+    // true if the head is inside the trap circle around a converge position with less energy than the barrier of the circle
+    bool is_trapped(const pendulum_system &the_system, const state_type &state, int position, const std::vector<energy_trap> &traps) const;
+
+    // owner hash of the convergence cache cells of the_system integrated with the_integrator and the convergence settings of this map, independent of the map grid
+    std::uint64_t convergence_cache_owner(const pendulum_system &the_system, const integrator_type &the_integrator) const;
+
+    // every cache_interval trials look the state up in the convergence cache and add it to the trail, returns true if the point is classified by the cache
+    bool check_cache(std::uint64_t owner, const state_type &state, double t, unsigned int trial_count, convergence_trail &trail, bool &cache_hit, unsigned int &cache_position, point_type &the_point) const;
+
+    // record the trail of a converged point into the convergence cache and count its cache hit
+    void finish_cache(std::uint64_t owner, const convergence_trail &trail, bool converged, bool cache_hit, unsigned int cache_position, const point_type &the_point, map_statistics *statistics) const;
+
+    // true if the start state is inside the pendulum length boundary and away from the undefined point at (0,0)
+    bool is_integrable(const pendulum_system &the_system, const state_type &start_state) const;
+
+    // index of the attractor the head is near, 254 for the middle or -1 if not near either
+    int near_position(const pendulum_system &the_system, double x, double y) const;
+
+    // first step size of a point starting at start_state estimated by the integrator, m_dt for integrators without an estimate
+    template <typename system>
+    double initial_step(const integrator_type &the_integrator, const system &the_system, const state_type &start_state, double t, std::true_type) const;
+    template <typename system>
+    double initial_step(const integrator_type &the_integrator, const system &the_system, const state_type &start_state, double t, std::false_type) const;
+};
+
+template <typename integrator_type>
+pendulum_map<integrator_type>::pendulum_map()
+{
+    attractor_colors.push_back(qRgb(255, 140, 0));
+    attractor_colors.push_back(qRgb(30, 144, 255));
+    attractor_colors.push_back(qRgb(178, 34, 34));
+}
+
+template <typename integrator_type>
+map_statistics pendulum_map<integrator_type>::parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const
+{
+    if (m_symmetry) {
+        return symmetric_integrate_map(the_system, the_integrator, the_map);
+    }
+    // multithreaded integration of the map
+    return parallel_tiles(the_map, [&](const map_tile &tile, map_statistics &statistics) {integrate_tile(the_integrator, the_system, the_map, tile, statistics);});
+}
+
+template <typename integrator_type>
+map_statistics pendulum_map<integrator_type>::symmetric_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map, map_file_writer *result_file) const
+{
+    const std::vector<attractor_symmetry> symmetries = the_system.symmetries(m_symmetry_tolerance);
+
+    // first the points without a source, the fundamental domain of the map
+    map_statistics statistics = parallel_tiles(the_map, [&](const map_tile &tile, map_statistics &tile_statistics) {
+        unsigned int next_i = tile.x_begin;
+        unsigned int next_j = tile.y_begin;
+        auto next_point = [&](unsigned int &i, unsigned int &j) {
+            unsigned int source_i;
+            unsigned int source_j;
+            const attractor_symmetry *symmetry;
+            for (; next_j < tile.y_end && tile.x_begin != tile.x_end; next_j++, next_i = tile.x_begin) {
+                for (; next_i < tile.x_end; next_i++) {
+                    if (!symmetric_source(symmetries, the_map, next_i, next_j, source_i, source_j, symmetry)) {
+                        i = next_i++;
+                        j = next_j;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+        integrate_points(the_integrator, the_system, the_map, next_point, tile_statistics);
+    });
+
+    // then the images, whose sources are all integrated by now
+    const map_statistics fill_statistics = parallel_tiles(the_map, [&](const map_tile &tile, map_statistics &tile_statistics) {
+        for (unsigned int j = tile.y_begin; j < tile.y_end; j++) {
+            for (unsigned int i = tile.x_begin; i < tile.x_end; i++) {
+                unsigned int source_i;
+                unsigned int source_j;
+                const attractor_symmetry *symmetry;
+                if (!symmetric_source(symmetries, the_map, i, j, source_i, source_j, symmetry)) {
+                    continue;
+                }
+                point_type the_point = the_map[the_map.index(source_i, source_j)];
+                if (the_point.converge_position < symmetry->permutation.size()) {
+                    the_point.converge_position = symmetry->permutation[the_point.converge_position];
+                }
+                the_map.set_point(the_map.index(i, j), the_point);
+                tile_statistics.add_point(the_point);
+                tile_statistics.symmetry_count++;
+            }
+        }
+        if (result_file != nullptr) {
+            result_file->write_tile(the_map, tile);
+        }
+    });
+    statistics.merge(fill_statistics);
+    return statistics;
+}
+
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::symmetric_source(const std::vector<attractor_symmetry> &symmetries, const map_type &the_map, unsigned int i, unsigned int j, unsigned int &source_i, unsigned int &source_j, const attractor_symmetry *&symmetry) const
+{
+    // grid points are integer multiples of the resolution, the point a symmetry maps onto (i, j) is found with the transposed (inverse) matrix
+    const double x = double(the_map.x_factor() + int(i));
+    const double y = double(the_map.y_factor() + int(j));
+    std::size_t source_index = the_map.index(i, j);
+    bool found = false;
+    for (const attractor_symmetry &candidate : symmetries) {
+        const double image_x = candidate.xx*x + candidate.yx*y;
+        const double image_y = candidate.xy*x + candidate.yy*y;
+        const double grid_x = std::round(image_x);
+        const double grid_y = std::round(image_y);
+        const double column = grid_x - the_map.x_factor();
+        const double row = grid_y - the_map.y_factor();
+        // off the grid or outside the map
+        if (std::abs(image_x - grid_x) > 1e-9 || std::abs(image_y - grid_y) > 1e-9 || column < 0.0 || row < 0.0 || column >= the_map.xdim() || row >= the_map.ydim()) {
+            continue;
+        }
+        const std::size_t index = the_map.index(unsigned(column), unsigned(row));
+        if (index < source_index) {
+            source_index = index;
+            source_i = unsigned(column);
+            source_j = unsigned(row);
+            symmetry = &candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+template <typename integrator_type>
+map_statistics pendulum_map<integrator_type>::boundary_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const
+{
+    return parallel_tiles(the_map, [&](const map_tile &tile, map_statistics &statistics) {boundary_integrate_tile(the_integrator, the_system, the_map, tile, statistics);});
+}
+
+template <typename integrator_type>
+template <typename tile_function>
+map_statistics pendulum_map<integrator_type>::parallel_tiles(map_type &the_map, tile_function process_tile, unsigned int tile_scale) const
+{
+    tile_scheduler scheduler(the_map.xdim(), the_map.ydim(), m_tile_width*tile_scale, m_tile_height*tile_scale);
+    std::vector<map_statistics> thread_statistics(std::max(thread_count(), 1u));
+    map_statistics statistics;
+    auto run_tile = [&](const map_tile &tile, unsigned int thread_index) {
+        // statistics are collected per tile and merged once per tile to keep threads off each others cache lines
+        map_statistics tile_statistics;
+        instrumented_tile(tile, thread_index, tile_statistics, process_tile);
+        thread_statistics[thread_index].merge(tile_statistics);
+    };
+    statistics.thread_timings = m_pool != nullptr ? scheduler.run(*m_pool, run_tile) : scheduler.run(m_nthreads, run_tile);
+    for (const auto &partial_statistics : thread_statistics) {
+        statistics.merge(partial_statistics);
+    }
+    return statistics;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::save_integrated_map (pendulum_system &the_system, integrator_type &the_integrator, QString filename, QDomElement xml_element) const
+{
+    if (m_streaming) {
+        stream_integrated_map(the_system, the_integrator, filename, xml_element);
+        return;
+    }
+
+    // timer for computation time
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    start = std::chrono::system_clock::now();
+
+    //create map container and integrate the map, the image buffers are filled as the points finish
+    map_type integration_map = create_map_container();
+    // a system without symmetries is integrated point by point, only a map that is filled by symmetry is marked so in its result file
+    const bool symmetric = symmetric_save() && !the_system.symmetries(m_symmetry_tolerance).empty();
+    std::unique_ptr<map_file_writer> result_file = create_result_file(the_system, the_integrator, integration_map, filename, symmetric);
+    // finished tiles are streamed to the result file while the other tiles integrate, checkpointed or cached tiles are read back instead
+    map_statistics statistics;
+    if (symmetric) {
+        statistics = symmetric_integrate_map(the_system, the_integrator, integration_map, result_file.get());
+    } else {
+        statistics = parallel_tiles(integration_map, [&](const map_tile &tile, map_statistics &tile_statistics) {
+            integrate_map_tile(the_integrator, the_system, integration_map, tile, tile_statistics, result_file.get());
+        });
+    }
+    end = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start; // elapsed time for the process
+    if (result_file) {
+        result_file->finish(elapsed_seconds.count(), statistics);
+    }
+
+    save_map_results(std::move(integration_map), statistics, elapsed_seconds.count(), filename, xml_element);
+}
+
+template <typename integrator_type>
+int pendulum_map<integrator_type>::save_progressive_map(const pendulum_system &the_system, const integrator_type &the_integrator, QString filename, QDomElement xml_element, unsigned int levels, double time_budget) const
+{
+    typedef std::chrono::steady_clock clock_type;
+    const clock_type::time_point start = clock_type::now();
+    const clock_type::time_point deadline = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(time_budget));
+    levels = std::max(levels, 1u);
+
+    map_type integration_map = create_map_container();
+    int finest_level = -1;
+    for (unsigned int level = levels; level-- > 0;) {
+        const unsigned int stride = 1u << level;
+        const bool reuse = level + 1 < levels;
+        std::atomic<bool> timed_out(false);
+        // tiles grow with the stride so every level hands out tiles with about the same number of points
+        // the coarsest level is the quick answer and is finished whatever the budget
+        const map_statistics run_statistics = parallel_tiles(integration_map, [&](const map_tile &tile, map_statistics &tile_statistics) {
+            if (reuse && time_budget > 0.0 && clock_type::now() > deadline) {
+                timed_out = true;
+                return;
+            }
+            integrate_level_tile(the_integrator, the_system, integration_map, tile, stride, reuse, tile_statistics);
+        }, stride);
+        if (timed_out) {
+            std::cout << "\nTime budget ran out while integrating level " << level << '\n';
+            break;
+        }
+        finest_level = level;
+
+        // copy the level out of the full grid, the factors of the level grid are only used for its images
+        const unsigned int level_xdim = (integration_map.xdim() - 1)/stride + 1;
+        const unsigned int level_ydim = (integration_map.ydim() - 1)/stride + 1;
+        map_type level_map(level_xdim, level_ydim, integration_map.x_factor()/int(stride), integration_map.y_factor()/int(stride), m_res*stride);
+        map_statistics level_statistics;
+        for (unsigned int j = 0; j < level_ydim; j++) {
+            for (unsigned int i = 0; i < level_xdim; i++) {
+                const point_type &the_point = integration_map[integration_map.index(i*stride, j*stride)];
+                level_map.set_point(level_map.index(i, j), the_point);
+                level_statistics.add_point(the_point);
+            }
+        }
+        level_statistics.thread_timings = run_statistics.thread_timings;
+        level_statistics.rejected_steps = run_statistics.rejected_steps;
+        level_statistics.rhs_evaluations = run_statistics.rhs_evaluations;
+        level_statistics.max_rejected_steps = run_statistics.max_rejected_steps;
+        for (tile_cost cost : run_statistics.tile_costs) {
+            // tiles of a level are in full grid indices, the level grid keeps every stride-th of them
+            cost.tile.x_begin = (cost.tile.x_begin + stride - 1)/stride;
+            cost.tile.x_end = (cost.tile.x_end + stride - 1)/stride;
+            cost.tile.y_begin = (cost.tile.y_begin + stride - 1)/stride;
+            cost.tile.y_end = (cost.tile.y_end + stride - 1)/stride;
+            level_statistics.tile_costs.push_back(cost);
+        }
+
+        QDomElement level_element = xml_element.ownerDocument().createElement("level");
+        level_element.setAttribute("index", level);
+        level_element.setAttribute("resolution", m_res*stride);
+        level_element.setAttribute("points_computed", run_statistics.total_count + run_statistics.outside_bounds_count);
+        xml_element.appendChild(level_element);
+        const std::chrono::duration<double> elapsed_seconds = clock_type::now() - start;
+        std::cout << "\nLevel " << level << " at resolution " << m_res*stride << ':';
+        save_map_results(std::move(level_map), level_statistics, elapsed_seconds.count(), filename + "_level" + QString::number(level), level_element);
+    }
+    xml_element.setAttribute("finest_level", finest_level);
+    return finest_level;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::integrate_level_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, unsigned int stride, bool reuse, map_statistics &statistics) const
+{
+    // walk the lattice points of the tile row by row
+    const unsigned int first_i = (tile.x_begin + stride - 1)/stride*stride;
+    unsigned int next_i = first_i;
+    unsigned int next_j = (tile.y_begin + stride - 1)/stride*stride;
+    auto next_point = [&](unsigned int &i, unsigned int &j) {
+        while (true) {
+            if (next_i >= tile.x_end) {
+                next_i = first_i;
+                next_j += stride;
+            }
+            if (next_j >= tile.y_end || first_i >= tile.x_end) {
+                return false;
+            }
+            i = next_i;
+            j = next_j;
+            next_i += stride;
+            if (!reuse || i % (2*stride) != 0 || j % (2*stride) != 0) {
+                return true;
+            }
+        }
+    };
+    integrate_points(the_integrator, the_system, the_map, next_point, statistics);
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::stream_integrated_map(const pendulum_system &the_system, const integrator_type &the_integrator, QString filename, QDomElement xml_element) const
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    start = std::chrono::system_clock::now();
+
+    unsigned int xdim;
+    unsigned int ydim;
+    int x_factor;
+    int y_factor;
+    map_dimensions(xdim, ydim, x_factor, y_factor);
+    std::unique_ptr<map_file_writer> result_file = open_result_file(the_system, the_integrator, xdim, ydim, x_factor, y_factor, filename);
+    // a shard only writes its result file, the images are made by merge_shards
+    const bool save_images = m_shard_count <= 1;
+    QFile position_file("position_map" + filename + ".ppm");
+    if (!result_file || (save_images && !position_file.open(QIODevice::WriteOnly | QIODevice::Truncate))) {
+        std::cout << "Could not create the streaming output files for map " << filename.toStdString() << '\n';
+        return;
+    }
+    if (save_images) {
+        const std::string position_header = "P6\n" + std::to_string(xdim) + " " + std::to_string(ydim) + "\n255\n";
+        position_file.write(position_header.data(), position_header.size());
+    }
+
+    QVector<QRgb> position_colors(256, qRgb(0, 0, 0));
+    std::copy(attractor_colors.begin(), attractor_colors.begin() + std::min<int>(int(attractor_colors.size()), 254), position_colors.begin());
+    position_colors[254] = mid_converge_color;
+    position_colors[255] = no_converge_color;
+
+    // bands start on tile rows so their tiles are tiles of the result file, they are integrated from the top of the map down in image row order
+    const unsigned int band_height = std::max((m_band_height + m_tile_height - 1)/m_tile_height, 1u)*m_tile_height;
+    const unsigned int band_count = (ydim + band_height - 1)/band_height;
+    map_statistics statistics;
+    std::vector<unsigned char> pixel_row(std::size_t(3)*xdim);
+    for (unsigned int band = band_count; band-- > 0;) {
+        const unsigned int row_begin = band*band_height;
+        const unsigned int row_end = std::min(row_begin + band_height, ydim);
+        map_type band_map(xdim, row_end - row_begin, x_factor, y_factor + int(row_begin), m_res);
+        map_statistics band_statistics = parallel_tiles(band_map, [&](const map_tile &tile, map_statistics &tile_statistics) {
+            integrate_map_tile(the_integrator, the_system, band_map, tile, tile_statistics, result_file.get());
+        });
+        for (tile_cost &cost : band_statistics.tile_costs) {
+            cost.tile.y_begin += row_begin;
+            cost.tile.y_end += row_begin;
+        }
+        statistics.merge(band_statistics);
+        statistics.thread_timings.resize(band_statistics.thread_timings.size());
+        for (std::size_t i = 0; i < band_statistics.thread_timings.size(); i++) {
+            statistics.thread_timings[i].busy_time += band_statistics.thread_timings[i].busy_time;
+            statistics.thread_timings[i].idle_time += band_statistics.thread_timings[i].idle_time;
+            statistics.thread_timings[i].tile_count += band_statistics.thread_timings[i].tile_count;
+        }
+
+        const unsigned char *positions = band_map.position_image();
+        for (unsigned int row = 0; save_images && row < band_map.ydim(); row++) {
+            for (unsigned int i = 0; i < xdim; i++) {
+                const QRgb color = position_colors[positions[std::size_t(row)*xdim + i]];
+                pixel_row[3*i] = qRed(color);
+                pixel_row[3*i + 1] = qGreen(color);
+                pixel_row[3*i + 2] = qBlue(color);
+            }
+            position_file.write(reinterpret_cast<const char *>(pixel_row.data()), pixel_row.size());
+        }
+    }
+    end = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    result_file->finish(elapsed_seconds.count(), statistics);
+    if (!save_images) {
+        save_map_results(map_type(), statistics, elapsed_seconds.count(), filename, xml_element);
+        return;
+    }
+    position_file.close();
+
+    report_map_statistics(statistics, elapsed_seconds.count(), xml_element);
+    stream_time_image(filename, statistics.max_time);
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::stream_time_image(QString filename, double max_time) const
+{
+    map_file_reader result_file(result_filename(filename));
+    QFile time_file("time_map" + filename + ".pgm");
+    if (!result_file.is_open() || !time_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        std::cout << "Could not create the time map of map " << filename.toStdString() << '\n';
+        return;
+    }
+    const map_file_header &header = result_file.header();
+    const std::string time_header = "P5\n" + std::to_string(header.xdim) + " " + std::to_string(header.ydim) + "\n255\n";
+    time_file.write(time_header.data(), time_header.size());
+
+    // same gray levels as the color table of the png time map
+    const int scale_factor = std::round(max_time) > 0.0 ? std::floor(255.0/std::round(max_time)) : 0;
+    std::vector<unsigned char> pixel_row(header.xdim);
+    for (unsigned int j = header.ydim; j-- > 0;) {
+        const unsigned int tile_y = j/header.tile_height;
+        const std::size_t tile_row = std::size_t(j%header.tile_height)*header.tile_width;
+        for (unsigned int tile_x = 0; tile_x < header.tiles_x; tile_x++) {
+            const map_file_point *points = result_file.tile(tile_x, tile_y) + tile_row;
+            const unsigned int i_begin = tile_x*header.tile_width;
+            const unsigned int i_end = std::min(i_begin + header.tile_width, header.xdim);
+            for (unsigned int i = i_begin; i < i_end; i++) {
+                pixel_row[i] = 255 - int(std::round(points[i - i_begin].converge_time))*scale_factor;
+            }
+        }
+        time_file.write(reinterpret_cast<const char *>(pixel_row.data()), pixel_row.size());
+    }
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::report_map_statistics(const map_statistics &statistics, double computation_time, QDomElement xml_element) const
+{
+    const double max_time = statistics.max_time;
+    double avg_integration_time = statistics.avg_integration_time();
+    double avg_step_count = statistics.avg_step_count();
+
+    xml_element.setAttribute("points_integrated", statistics.total_count);
+    xml_element.setAttribute("mid_converge_count", statistics.mid_converge_count);
+    xml_element.setAttribute("points_outside_bounds", statistics.outside_bounds_count);
+    xml_element.setAttribute("computation_time", computation_time);
+    xml_element.setAttribute("avg_integration_time", avg_integration_time);
+    xml_element.setAttribute("avg_number_of_steps", avg_step_count);
+    xml_element.setAttribute("max_integration_time", max_time);
+    xml_element.setAttribute("cpu_isa", QString(cpu_isa_name(m_cpu_isa)));
+    std::cout << "\nTotal number of points: " << statistics.total_count << "\n";
+    std::cout << "Points outside bounds: " << statistics.outside_bounds_count << "\n";
+    std::cout << "Mid converge count: " << statistics.mid_converge_count << '\n';
+    std::cout << "Average integration time: " << avg_integration_time << '\n';
+    std::cout << "Average number of steps: " << avg_step_count << '\n';
+    std::cout << "Max integration time: " << max_time << '\n';
+    std::cout << "Elapsed time: " << computation_time << "s\n";
+    if (m_cache != nullptr) {
+        const double hit_rate = statistics.total_count > 0 ? double(statistics.cache_hit_count)/double(statistics.total_count) : 0.0;
+        xml_element.setAttribute("cache_hits", statistics.cache_hit_count);
+        xml_element.setAttribute("cache_hit_rate", hit_rate);
+        xml_element.setAttribute("cache_cells", (unsigned int)(m_cache->size()));
+        std::cout << "Convergence cache hits: " << statistics.cache_hit_count << " (" << hit_rate << " of the points), " << m_cache->size() << " cells\n";
+        if (m_verify_cache) {
+            const double agreement = statistics.cache_hit_count > 0 ? double(statistics.cache_agree_count)/double(statistics.cache_hit_count) : 1.0;
+            xml_element.setAttribute("cache_agreement", agreement);
+            std::cout << "Convergence cache agreement with full integration: " << agreement << '\n';
+        }
+    }
+    if (statistics.restored_count > 0) {
+        xml_element.setAttribute("points_restored", statistics.restored_count);
+        std::cout << "Points restored from checkpoint: " << statistics.restored_count << '\n';
+    }
+    if (m_tile_cache != nullptr) {
+        xml_element.setAttribute("points_reused", statistics.reused_count);
+        std::cout << "Points reused from the tile cache: " << statistics.reused_count << '\n';
+    }
+    if (m_symmetry) {
+        xml_element.setAttribute("points_filled_by_symmetry", statistics.symmetry_count);
+        std::cout << "Points filled by symmetry: " << statistics.symmetry_count << '\n';
+    }
+    if (m_boundary_tracing) {
+        xml_element.setAttribute("points_filled", statistics.filled_count);
+        xml_element.setAttribute("points_verified", statistics.verified_count);
+        xml_element.setAttribute("verification_mismatches", statistics.verify_mismatch_count);
+        std::cout << "Points filled by boundary tracing: " << statistics.filled_count << '\n';
+        std::cout << "Filled points verified: " << statistics.verified_count << ", mismatches: " << statistics.verify_mismatch_count << '\n';
+    }
+    if (!statistics.thread_timings.empty()) {
+        report_thread_timings(statistics.thread_timings, xml_element);
+    }
+    if (instrumentation_enabled) {
+        report_instrumentation(statistics, xml_element);
+    }
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::save_map_results(map_type integration_map, const map_statistics &statistics, double computation_time, QString filename, QDomElement xml_element) const
+{
+    const int xdim = integration_map.xdim();
+    const int ydim = integration_map.ydim();
+    const double max_time = statistics.max_time;
+
+    report_map_statistics(statistics, computation_time, xml_element);
+    if (m_shard_count > 1) {
+        // the grid only holds the tiles of this shard, the images are saved by merge_shards
+        xml_element.setAttribute("shard_index", m_shard_index);
+        xml_element.setAttribute("shard_count", m_shard_count);
+        std::cout << "Shard " << m_shard_index << " of " << m_shard_count << " written to " << result_filename(filename, m_shard_index, m_shard_count).toStdString() << '\n';
+        return;
+    }
+
+    // the images use the grid buffers directly, with an image writer the grid moves to the heap and lives until both images are saved
+    std::shared_ptr<map_type> image_map;
+    map_type *pixel_map = &integration_map;
+    if (m_image_writer != nullptr) {
+        image_map = std::make_shared<map_type>(std::move(integration_map));
+        pixel_map = image_map.get();
+    }
+
+    const QImage position_map_image = position_image(*pixel_map);
+    if (m_image_writer != nullptr) {
+        m_image_writer->save(position_map_image, "position_map" + filename + ".png", image_map);
+    } else {
+        position_map_image.save("position_map" + filename + ".png");
+    }
+
+    const QImage time_map_image = time_image(*pixel_map, max_time);
+    if (m_image_writer != nullptr) {
+        m_image_writer->save(time_map_image, "time_map" + filename + ".png", image_map);
+    } else {
+        time_map_image.save("time_map" + filename + ".png");
+    }
+
+    if (instrumentation_enabled && !statistics.tile_costs.empty()) {
+        save_cost_image(statistics.tile_costs, xdim, ydim, "cost_map" + filename + ".png");
+    }
+}
+
+template <typename integrator_type>
+QImage pendulum_map<integrator_type>::position_image(map_type &the_map) const
+{
+    QImage position_map_image(the_map.position_image(), the_map.xdim(), the_map.ydim(), the_map.xdim(), QImage::Format_Indexed8);
+    position_map_image.setColorTable(attractor_colors);
+    position_map_image.setColor(254, mid_converge_color);
+    position_map_image.setColor(255, no_converge_color);
+    return position_map_image;
+}
+
+template <typename integrator_type>
+QImage pendulum_map<integrator_type>::time_image(map_type &the_map, double max_time) const
+{
+    QImage time_map_image(the_map.time_image(), the_map.xdim(), the_map.ydim(), the_map.xdim(), QImage::Format_Indexed8);
+    // a map whose points all left the bounds or converged at once has a max_time of 0 and a single gray level
+    const int scale_factor = std::round(max_time) > 0.0 ? std::floor(255.0/std::round(max_time)) : 0;
+    for (unsigned int i = 0; i <= std::round(max_time); i++) {
+        time_map_image.setColor(i, qRgb(255-i*scale_factor, 255-i*scale_factor, 255-i*scale_factor));
+    }
+    return time_map_image;
+}
+
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::merge_shards(QString filename, unsigned int shard_count, QDomElement xml_element) const
+{
+    shard_count = std::max(shard_count, 1u);
+    std::vector<std::unique_ptr<map_file_reader>> shards;
+    for (unsigned int shard_index = 0; shard_index < shard_count; shard_index++) {
+        const QString shard_filename = result_filename(filename, shard_index, shard_count);
+        std::unique_ptr<map_file_reader> shard(new map_file_reader(shard_filename));
+        if (!shard->is_open() || shard->header().complete == 0 || shard->header().shard_index != shard_index
+                || shard->header().shard_count != shard_count || (!shards.empty() && !same_map_file(*shards.front(), *shard))) {
+            std::cout << "Result file " << shard_filename.toStdString() << " is missing, incomplete or not a shard of map " << filename.toStdString() << '\n';
+            return false;
+        }
+        shards.push_back(std::move(shard));
+    }
+
+    const map_file_header &header = shards.front()->header();
+    map_type merged_map(header.xdim, header.ydim, header.x_factor, header.y_factor, header.resolution);
+    map_statistics statistics;
+    for (unsigned int tile_y = 0; tile_y < header.tiles_y; tile_y++) {
+        for (unsigned int tile_x = 0; tile_x < header.tiles_x; tile_x++) {
+            const map_file_reader &shard = *shards[(std::uint64_t(tile_y)*header.tiles_x + tile_x) % shard_count];
+            if (!shard.has_tile(tile_x, tile_y)) {
+                std::cout << "Tile (" << tile_x << ", " << tile_y << ") is missing from shard " << shard.header().shard_index << " of map " << filename.toStdString() << '\n';
+                return false;
+            }
+            const map_file_point *records = shard.tile(tile_x, tile_y);
+            const unsigned int i_begin = tile_x*header.tile_width;
+            const unsigned int j_begin = tile_y*header.tile_height;
+            for (unsigned int j = j_begin; j < std::min(j_begin + header.tile_height, header.ydim); j++) {
+                const map_file_point *row = records + std::size_t(j - j_begin)*header.tile_width;
+                for (unsigned int i = i_begin; i < std::min(i_begin + header.tile_width, header.xdim); i++) {
+                    const point_type the_point = row[i - i_begin].point();
+                    merged_map.set_point(merged_map.index(i, j), the_point);
+                }
+            }
+        }
+    }
+
+    double total_shard_time = 0.0;
+    double max_shard_time = 0.0;
+    for (const auto &shard : shards) {
+        const double shard_time = shard->header().computation_time;
+        statistics.merge(shard->header().statistics.statistics());
+        total_shard_time += shard_time;
+        max_shard_time = std::max(max_shard_time, shard_time);
+
+        QDomElement shard_element = xml_element.ownerDocument().createElement("shard");
+        shard_element.setAttribute("index", shard->header().shard_index);
+        shard_element.setAttribute("computation_time", shard_time);
+        xml_element.appendChild(shard_element);
+    }
+    xml_element.setAttribute("shard_count", shard_count);
+    xml_element.setAttribute("total_shard_computation_time", total_shard_time);
+    std::cout << "\nMerged " << shard_count << " shards of map " << filename.toStdString() << ", total shard computation time " << total_shard_time << "s\n";
+
+    // the merged map is saved as an unsharded one whatever the shard of this mapper
+    pendulum_map merger(*this);
+    merger.set_shard(0, 1);
+    merger.save_map_results(std::move(merged_map), statistics, max_shard_time, filename, xml_element);
+    return true;
+}
+
+template <typename integrator_type>
+map_statistics pendulum_map<integrator_type>::compare_convergence_policies(const pendulum_system &the_system, const integrator_type &the_integrator, QDomElement xml_element) const
+{
+    pendulum_map dwell_mapper(*this);
+    pendulum_map energy_mapper(*this);
+    dwell_mapper.set_convergence_policy(convergence_policy::dwell);
+    energy_mapper.set_convergence_policy(convergence_policy::energy);
+
+    map_type dwell_map = create_map_container();
+    map_type energy_map = create_map_container();
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    const map_statistics dwell_statistics = dwell_mapper.parallel_integrate_map(the_system, the_integrator, dwell_map);
+    std::chrono::time_point<std::chrono::steady_clock> middle = std::chrono::steady_clock::now();
+    const map_statistics energy_statistics = energy_mapper.parallel_integrate_map(the_system, the_integrator, energy_map);
+    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> dwell_seconds = middle-start;
+    const std::chrono::duration<double> energy_seconds = end-middle;
+
+    unsigned int agree_count = 0;
+    for (std::size_t i = 0; i < dwell_map.size(); i++) {
+        agree_count += (dwell_map[i].converge_position == energy_map[i].converge_position) ? 1 : 0;
+    }
+    const double agreement = dwell_map.size() > 0 ? double(agree_count)/double(dwell_map.size()) : 1.0;
+    const double speedup = dwell_seconds.count()/energy_seconds.count();
+
+    xml_element.setAttribute("dwell_computation_time", dwell_seconds.count());
+    xml_element.setAttribute("energy_computation_time", energy_seconds.count());
+    xml_element.setAttribute("energy_speedup", speedup);
+    xml_element.setAttribute("dwell_avg_number_of_steps", dwell_statistics.avg_step_count());
+    xml_element.setAttribute("energy_avg_number_of_steps", energy_statistics.avg_step_count());
+    xml_element.setAttribute("policy_agreement", agreement);
+    std::cout << "\nDwell policy: " << dwell_seconds.count() << "s, average number of steps " << dwell_statistics.avg_step_count() << '\n';
+    std::cout << "Energy policy: " << energy_seconds.count() << "s, average number of steps " << energy_statistics.avg_step_count() << '\n';
+    std::cout << "Energy policy speedup: " << speedup << ", classification agreement: " << agreement << '\n';
+    return energy_statistics;
+}
+
+template <typename integrator_type>
+map_statistics pendulum_map<integrator_type>::compare_precision(const pendulum_system &the_system, const integrator_type &the_integrator, QDomElement xml_element) const
+{
+    pendulum_map double_mapper(*this);
+    pendulum_map mixed_mapper(*this);
+    double_mapper.set_precision(integration_precision::double_precision);
+    mixed_mapper.set_precision(integration_precision::mixed);
+
+    map_type double_map = create_map_container();
+    map_type mixed_map = create_map_container();
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    const map_statistics double_statistics = double_mapper.parallel_integrate_map(the_system, the_integrator, double_map);
+    std::chrono::time_point<std::chrono::steady_clock> middle = std::chrono::steady_clock::now();
+    const map_statistics mixed_statistics = mixed_mapper.parallel_integrate_map(the_system, the_integrator, mixed_map);
+    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> double_seconds = middle-start;
+    const std::chrono::duration<double> mixed_seconds = end-middle;
+
+    unsigned int differ_count = 0;
+    for (std::size_t i = 0; i < double_map.size(); i++) {
+        differ_count += (double_map[i].converge_position != mixed_map[i].converge_position) ? 1 : 0;
+    }
+    const double differ_fraction = double_map.size() > 0 ? double(differ_count)/double(double_map.size()) : 0.0;
+    const double speedup = double_seconds.count()/mixed_seconds.count();
+
+    xml_element.setAttribute("double_computation_time", double_seconds.count());
+    xml_element.setAttribute("mixed_computation_time", mixed_seconds.count());
+    xml_element.setAttribute("mixed_speedup", speedup);
+    xml_element.setAttribute("double_avg_number_of_steps", double_statistics.avg_step_count());
+    xml_element.setAttribute("mixed_avg_number_of_steps", mixed_statistics.avg_step_count());
+    xml_element.setAttribute("precision_differ_fraction", differ_fraction);
+    std::cout << "\nDouble precision: " << double_seconds.count() << "s, average number of steps " << double_statistics.avg_step_count() << '\n';
+    std::cout << "Mixed precision: " << mixed_seconds.count() << "s, average number of steps " << mixed_statistics.avg_step_count() << '\n';
+    std::cout << "Mixed precision speedup: " << speedup << ", converge position differs for " << differ_fraction << " of the points\n";
+    return mixed_statistics;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::report_thread_timings(const std::vector<thread_timing> &timings, QDomElement xml_element) const
+{
+    double min_utilization = 1.0;
+    double total_utilization = 0.0;
+    for (unsigned int i = 0; i < timings.size(); i++) {
+        const double run_time = timings[i].busy_time + timings[i].idle_time;
+        const double utilization = run_time > 0.0 ? timings[i].busy_time/run_time : 1.0;
+        min_utilization = std::min(min_utilization, utilization);
+        total_utilization += utilization;
+        std::cout << "Thread " << i << ": busy " << timings[i].busy_time << "s, idle " << timings[i].idle_time << "s, " << timings[i].tile_count << " tiles\n";
+
+        QDomElement thread_element = xml_element.ownerDocument().createElement("thread");
+        thread_element.setAttribute("index", i);
+        thread_element.setAttribute("busy_time", timings[i].busy_time);
+        thread_element.setAttribute("idle_time", timings[i].idle_time);
+        thread_element.setAttribute("tile_count", timings[i].tile_count);
+        xml_element.appendChild(thread_element);
+    }
+    const double avg_utilization = timings.empty() ? 0.0 : total_utilization/double(timings.size());
+    xml_element.setAttribute("thread_count", (unsigned int)(timings.size()));
+    xml_element.setAttribute("min_thread_utilization", min_utilization);
+    xml_element.setAttribute("avg_thread_utilization", avg_utilization);
+    std::cout << "Thread utilization: min " << min_utilization << ", avg " << avg_utilization << '\n';
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::report_instrumentation(const map_statistics &statistics, QDomElement xml_element) const
+{
+    const unsigned long long trial_steps = statistics.total_steps + statistics.rejected_steps;
+    const double rejected_fraction = trial_steps > 0 ? double(statistics.rejected_steps)/double(trial_steps) : 0.0;
+    const double avg_rhs_evaluations = statistics.total_count > 0 ? double(statistics.rhs_evaluations)/double(statistics.total_count) : 0.0;
+    xml_element.setAttribute("rejected_steps", statistics.rejected_steps);
+    xml_element.setAttribute("rejected_step_fraction", rejected_fraction);
+    xml_element.setAttribute("max_rejected_steps", statistics.max_rejected_steps);
+    xml_element.setAttribute("rhs_evaluations", statistics.rhs_evaluations);
+    xml_element.setAttribute("avg_rhs_evaluations", avg_rhs_evaluations);
+    std::cout << "Rejected steps: " << statistics.rejected_steps << " (" << rejected_fraction << " of the trial steps), max per point " << statistics.max_rejected_steps << '\n';
+    std::cout << "RHS evaluations: " << statistics.rhs_evaluations << ", average per point " << avg_rhs_evaluations << '\n';
+    if (statistics.tile_costs.empty()) {
+        return;
+    }
+
+    // tile cost spread and the integration time, work and tiles of every thread
+    double total_seconds = 0.0;
+    double max_seconds = 0.0;
+    std::vector<tile_cost> thread_costs;
+    for (const tile_cost &cost : statistics.tile_costs) {
+        total_seconds += cost.seconds;
+        max_seconds = std::max(max_seconds, cost.seconds);
+        if (cost.thread_index >= thread_costs.size()) {
+            thread_costs.resize(cost.thread_index + 1);
+        }
+        thread_costs[cost.thread_index].seconds += cost.seconds;
+        thread_costs[cost.thread_index].rhs_evaluations += cost.rhs_evaluations;
+        thread_costs[cost.thread_index].rejected_steps += cost.rejected_steps;
+    }
+    const double avg_seconds = total_seconds/double(statistics.tile_costs.size());
+    const double imbalance = avg_seconds > 0.0 ? max_seconds/avg_seconds : 1.0;
+    xml_element.setAttribute("tile_count", (unsigned int)(statistics.tile_costs.size()));
+    xml_element.setAttribute("avg_tile_time", avg_seconds);
+    xml_element.setAttribute("max_tile_time", max_seconds);
+    xml_element.setAttribute("tile_time_imbalance", imbalance);
+    std::cout << "Tile time: avg " << avg_seconds << "s, max " << max_seconds << "s (" << imbalance << " times the average)\n";
+    for (unsigned int i = 0; i < thread_costs.size(); i++) {
+        QDomElement thread_element = xml_element.ownerDocument().createElement("thread_cost");
+        thread_element.setAttribute("index", i);
+        thread_element.setAttribute("tile_time", thread_costs[i].seconds);
+        thread_element.setAttribute("rhs_evaluations", thread_costs[i].rhs_evaluations);
+        thread_element.setAttribute("rejected_steps", thread_costs[i].rejected_steps);
+        xml_element.appendChild(thread_element);
+    }
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::save_cost_image(const std::vector<tile_cost> &tile_costs, unsigned int xdim, unsigned int ydim, QString filename) const
+{
+    // time per point so the smaller tiles at the map edges compare with the full ones
+    std::vector<double> point_seconds(tile_costs.size());
+    double max_point_seconds = 0.0;
+    for (std::size_t k = 0; k < tile_costs.size(); k++) {
+        const map_tile &tile = tile_costs[k].tile;
+        const unsigned int point_count = std::max((tile.x_end - tile.x_begin)*(tile.y_end - tile.y_begin), 1u);
+        point_seconds[k] = tile_costs[k].seconds/point_count;
+        max_point_seconds = std::max(max_point_seconds, point_seconds[k]);
+    }
+
+    QImage cost_image(xdim, ydim, QImage::Format_Indexed8);
+    // black through red and yellow to white
+    cost_image.setColorCount(256);
+    for (int i = 0; i < 256; i++) {
+        cost_image.setColor(i, qRgb(std::min(3*i, 255), std::min(std::max(3*i - 255, 0), 255), std::max(3*i - 510, 0)));
+    }
+    for (unsigned int row = 0; row < ydim; row++) {
+        std::fill(cost_image.scanLine(row), cost_image.scanLine(row) + xdim, 0);
+    }
+    for (std::size_t k = 0; k < tile_costs.size(); k++) {
+        const map_tile &tile = tile_costs[k].tile;
+        const unsigned char level = max_point_seconds > 0.0 ? (unsigned char)(std::round(255.0*point_seconds[k]/max_point_seconds)) : 0;
+        // image rows run from the top of the map down
+        for (unsigned int j = tile.y_begin; j < std::min(tile.y_end, ydim); j++) {
+            unsigned char *line = cost_image.scanLine(ydim - 1 - j);
+            std::fill(line + std::min(tile.x_begin, xdim), line + std::min(tile.x_end, xdim), level);
+        }
+    }
+    if (m_image_writer != nullptr) {
+        m_image_writer->save(cost_image, filename);
+    } else {
+        cost_image.save(filename);
+    }
+}
+
+template <typename integrator_type>
+std::unique_ptr<map_file_writer> pendulum_map<integrator_type>::create_result_file(const pendulum_system &the_system, const integrator_type &the_integrator, const map_type &the_map, QString filename, bool symmetric) const
+{
+    if (!m_result_file && m_shard_count <= 1) {
+        return nullptr;
+    }
+    return open_result_file(the_system, the_integrator, the_map.xdim(), the_map.ydim(), the_map.x_factor(), the_map.y_factor(), filename, symmetric);
+}
+
+template <typename integrator_type>
+std::unique_ptr<map_file_writer> pendulum_map<integrator_type>::open_result_file(const pendulum_system &the_system, const integrator_type &the_integrator, unsigned int xdim, unsigned int ydim, int x_factor, int y_factor, QString filename, bool symmetric) const
+{
+    map_file_header header = result_file_header(the_system, the_integrator);
+    if (symmetric) {
+        header.flags |= map_file_symmetry;
+    }
+    header.xdim = xdim;
+    header.ydim = ydim;
+    header.x_factor = x_factor;
+    header.y_factor = y_factor;
+
+    const QString file_name = result_filename(filename, m_shard_index, m_shard_count);
+    std::unique_ptr<map_file_writer> writer(new map_file_writer(file_name, header, the_system, m_resume, m_checkpoint_interval));
+    if (!writer->is_open()) {
+        std::cout << "Could not create result file " << file_name.toStdString() << '\n';
+        return nullptr;
+    }
+    if (writer->resumed_tile_count() > 0) {
+        std::cout << "Resuming " << file_name.toStdString() << ": " << writer->resumed_tile_count() << " of " << writer->header().tiles_x*writer->header().tiles_y
+                  << " tiles restored from its checkpoint instead of integrating them\n";
+    }
+    return writer;
+}
+
+template <typename integrator_type>
+QString pendulum_map<integrator_type>::result_filename(QString filename, unsigned int shard_index, unsigned int shard_count)
+{
+    if (shard_count <= 1) {
+        return "result_map" + filename + ".spmap";
+    }
+    return "result_map" + filename + "_shard" + QString::number(shard_index) + "of" + QString::number(shard_count) + ".spmap";
+}
+
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::in_shard(const map_type &the_map, const map_tile &tile) const
+{
+    if (m_shard_count <= 1) {
+        return true;
+    }
+    // tile index in the tiling of the whole map, the_map may be a band of it
+    unsigned int xdim;
+    unsigned int ydim;
+    int x_factor;
+    int y_factor;
+    map_dimensions(xdim, ydim, x_factor, y_factor);
+    const unsigned int tile_width = std::max(m_tile_width, 1u);
+    const unsigned int tile_height = std::max(m_tile_height, 1u);
+    const unsigned int tiles_x = (xdim + tile_width - 1)/tile_width;
+    const unsigned int tile_x = (tile.x_begin + (the_map.x_factor() - x_factor))/tile_width;
+    const unsigned int tile_y = (tile.y_begin + (the_map.y_factor() - y_factor))/tile_height;
+    return (std::uint64_t(tile_y)*tiles_x + tile_x) % m_shard_count == m_shard_index;
+}
+
+template <typename integrator_type>
+map_file_header pendulum_map<integrator_type>::result_file_header(const pendulum_system &the_system, const integrator_type &the_integrator) const
+{
+    map_file_header header;
+    header.resolution = m_res;
+    header.tile_width = m_tile_width;
+    header.tile_height = m_tile_height;
+    header.d = the_system.d;
+    header.m = the_system.m;
+    header.g = the_system.g;
+    header.b = the_system.b;
+    header.L = the_system.L;
+    header.start_time = m_tstart;
+    header.step_size = m_dt;
+    header.position_tolerance = m_pos_tol;
+    header.mid_position_tolerance = m_mid_tol;
+    header.time_tolerance = m_time_tol;
+    header.flags = (m_batch_mode ? map_file_batch_mode : 0) | (m_boundary_tracing ? map_file_boundary_tracing : 0)
+            | (m_policy == convergence_policy::energy ? map_file_energy_policy : 0) | (m_cache != nullptr && !m_verify_cache ? map_file_convergence_cache : 0)
+            | (has_step_controller<integrator_type>::value && m_step_controller == step_controller::proportional_integral ? map_file_pi_controller : 0)
+            | (has_initial_step<integrator_type>::value && m_automatic_initial_step ? map_file_automatic_initial_step : 0)
+            | (float_derivatives(the_system) ? map_file_mixed_precision : 0)
+            | (m_batch_mode && has_batch_step<integrator_type>::value && m_cpu_isa == cpu_isa::avx2 ? map_file_isa_avx2 : 0)
+            | (m_batch_mode && has_batch_step<integrator_type>::value && m_cpu_isa == cpu_isa::avx512 ? map_file_isa_avx512 : 0);
+    header.shard_index = m_shard_index;
+    header.shard_count = m_shard_count;
+    set_map_file_integrator(header, the_integrator, 0);
+    return header;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::map_dimensions(unsigned int &xdim, unsigned int &ydim, int &x_factor, int &y_factor) const
+{
+    xdim = std::abs(std::round((m_xend-m_xstart)/m_res))+1;
+    ydim = std::abs(std::round((m_yend-m_ystart)/m_res))+1;
+    x_factor = std::round(m_xstart/m_res); // create int multipliers to fill array to avoid floating math rounding error
+    y_factor = std::round(m_ystart/m_res);
+}
+
+template <typename integrator_type>
+map_type pendulum_map<integrator_type>::create_map_container() const
+{
+    unsigned int xdim;
+    unsigned int ydim;
+    int xdim_factor;
+    int ydim_factor;
+    map_dimensions(xdim, ydim, xdim_factor, ydim_factor);
+    if (m_pool == nullptr || m_pool->is_worker_thread()) {
+        return map_type(xdim, ydim, xdim_factor, ydim_factor, m_res);
+    }
+
+    // first touch: each worker initializes one band of rows, placing those pages on its NUMA node when the workers are pinned
+    map_type the_map(xdim, ydim, xdim_factor, ydim_factor, m_res, false);
+    const unsigned int nbands = m_pool->size();
+    m_pool->run([&](unsigned int band) {
+        the_map.initialize_rows(unsigned(std::size_t(ydim)*band/nbands), unsigned(std::size_t(ydim)*(band+1)/nbands));
+    });
+    return the_map;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const
+{
+    // rows in the outer loop follow the memory order of the grid
+    unsigned int next_i = tile.x_begin;
+    unsigned int next_j = tile.y_begin;
+    auto next_point = [&](unsigned int &i, unsigned int &j) {
+        if (next_i == tile.x_end) {
+            next_i = tile.x_begin;
+            next_j++;
+        }
+        if (next_j >= tile.y_end || tile.x_begin == tile.x_end) {
+            return false;
+        }
+        i = next_i++;
+        j = next_j;
+        return true;
+    };
+    integrate_points(the_integrator, the_system, the_map, next_point, statistics);
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::integrate_map_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics, map_file_writer *result_file) const
+{
+    if (!in_shard(the_map, tile)) {
+        return;
+    }
+    if (result_file != nullptr && result_file->has_tile(the_map, tile)) {
+        result_file->read_tile(the_map, tile, statistics);
+        return;
+    }
+    if (m_tile_cache != nullptr) {
+        cached_integrate_tile(the_integrator, the_system, the_map, tile, statistics);
+    } else if (m_boundary_tracing) {
+        boundary_integrate_tile(the_integrator, the_system, the_map, tile, statistics);
+    } else {
+        integrate_tile(the_integrator, the_system, the_map, tile, statistics);
+    }
+    if (result_file != nullptr) {
+        result_file->write_tile(the_map, tile);
+    }
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::cached_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const
+{
+    const std::string key = tile_cache::make_key(result_file_header(the_system, the_integrator), the_system);
+    std::vector<char> restored;
+    const unsigned int restored_count = m_tile_cache->load(key, the_map, tile, restored, statistics);
+    const unsigned int tile_width = tile.x_end - tile.x_begin;
+    if (restored_count == restored.size()) {
+        return;
+    }
+    if (m_boundary_tracing && restored_count == 0) {
+        boundary_integrate_tile(the_integrator, the_system, the_map, tile, statistics);
+    } else {
+        // only the points that are not cached are integrated, point by point also in boundary tracing mode
+        std::size_t next_point_index = 0;
+        auto next_point = [&](unsigned int &i, unsigned int &j) {
+            while (next_point_index < restored.size() && restored[next_point_index]) {
+                next_point_index++;
+            }
+            if (next_point_index == restored.size()) {
+                return false;
+            }
+            i = tile.x_begin + next_point_index % tile_width;
+            j = tile.y_begin + next_point_index / tile_width;
+            next_point_index++;
+            return true;
+        };
+        integrate_points(the_integrator, the_system, the_map, next_point, statistics);
+    }
+    m_tile_cache->store(key, the_map, tile);
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::boundary_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const
 {
-public:
-    pendulum_map();
+    typedef std::pair<unsigned int, unsigned int> grid_point;
+    const unsigned int tile_width = tile.x_end - tile.x_begin;
+    std::vector<char> done(std::size_t(tile_width)*(tile.y_end - tile.y_begin), 0);
+    auto is_done = [&](unsigned int i, unsigned int j) -> char & {return done[std::size_t(j - tile.y_begin)*tile_width + (i - tile.x_begin)];};
+    auto point_at = [&](unsigned int i, unsigned int j) -> const point_type & {return the_map[the_map.index(i, j)];};
 
-    //! Parallel integrate and save colored map of convergence and grayscale map of integration time as a png, file name is of the form position_map*filename*.png and time_map*filename*.png (without the asterisks)
-    void save_integrated_map(pendulum_system &the_system, integrator_type &the_integrator, QString filename, QDomElement xml_element) const;
+    // queue a point for integration unless it is already known
+    std::vector<grid_point> points;
+    auto add_point = [&](unsigned int i, unsigned int j) {
+        if (!is_done(i, j)) {
+            is_done(i, j) = 1;
+            points.push_back(grid_point(i, j));
+        }
+    };
+    auto integrate_queued_points = [&]() {
+        std::size_t next = 0;
+        integrate_points(the_integrator, the_system, the_map, [&](unsigned int &i, unsigned int &j) {
+            if (next == points.size()) {
+                return false;
+            }
+            i = points[next].first;
+            j = points[next].second;
+            next++;
+            return true;
+        }, statistics);
+        points.clear();
+    };
 
-    //! Parallel integrate the map, splits the map into chunks to be integrated on separate threads by pendulum_map::integrate_map
-    void parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const;
+    // every verify_interval-th filled point is integrated instead of filled
+    const unsigned int verify_interval = m_verify_fraction > 0.0 ? unsigned(std::max(1.0, std::round(1.0/m_verify_fraction))) : 0;
+    unsigned int fill_counter = 0;
 
-    //! Integrate a single point of type point_type
-    void integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, point_type &the_point) const;
+    // rectangles are traced a subdivision level at a time so that each integrate_points call gets the borders of all rectangles of a level, which keeps batch lanes full
+    std::vector<map_tile> rectangles(1, tile);
+    std::vector<map_tile> next_rectangles;
+    std::vector<std::pair<grid_point, unsigned int>> verify_points; // sampled fill points with the converge position they were filled with
+    while (!rectangles.empty()) {
+        for (const auto &rect : rectangles) {
+            for (unsigned int i = rect.x_begin; i < rect.x_end; i++) {
+                add_point(i, rect.y_begin);
+                add_point(i, rect.y_end - 1);
+            }
+            for (unsigned int j = rect.y_begin; j < rect.y_end; j++) {
+                add_point(rect.x_begin, j);
+                add_point(rect.x_end - 1, j);
+            }
+        }
+        integrate_queued_points();
 
-    //! Create a map of type map_type (vector of vectors of point_type) for the current x-y ranges and resolution.
-    map_type create_map_container() const;
+        next_rectangles.clear();
+        verify_points.clear();
+        for (const auto &rect : rectangles) {
+            const unsigned int x_last = rect.x_end - 1;
+            const unsigned int y_last = rect.y_end - 1;
+            const unsigned int width = rect.x_end - rect.x_begin;
+            const unsigned int height = rect.y_end - rect.y_begin;
+            if (width <= 2 || height <= 2) {
+                continue; // no interior
+            }
 
-    //! Integrate a map of points and stop after converging to an attractor or the middle, stores relevent point integration information inside the points in the process.
-    void integrate_map(const integrator_type &the_integrator, const pendulum_system &the_system, map_iter first, map_iter last) const;
+            // the rectangle lies inside the pendulum length boundary if its corners do, and must not hold the unset point at (0,0)
+            const state_type low_corner = the_map.start_state(rect.x_begin, rect.y_begin);
+            const state_type high_corner = the_map.start_state(x_last, y_last);
+            bool fillable = is_integrable(the_system, low_corner) && is_integrable(the_system, high_corner)
+                    && is_integrable(the_system, the_map.start_state(rect.x_begin, y_last)) && is_integrable(the_system, the_map.start_state(x_last, rect.y_begin))
+                    && !(low_corner[0] <= 0.0 && 0.0 <= high_corner[0] && low_corner[1] <= 0.0 && 0.0 <= high_corner[1]);
+            const unsigned int fill_position = point_at(rect.x_begin, rect.y_begin).converge_position;
+            fillable = fillable && fill_position != 255;
+            for (unsigned int i = rect.x_begin; fillable && i < rect.x_end; i++) {
+                fillable = point_at(i, rect.y_begin).converge_position == fill_position && point_at(i, y_last).converge_position == fill_position;
+            }
+            for (unsigned int j = rect.y_begin; fillable && j < rect.y_end; j++) {
+                fillable = point_at(rect.x_begin, j).converge_position == fill_position && point_at(x_last, j).converge_position == fill_position;
+            }
 
-    //! Integrate a point with a fixed integration time.
-    void fixed_integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, point_type &the_point) const;
+            if (fillable) {
+                // converge time and step count are blended from the four edges (transfinite interpolation), the times are clamped to the
+                // range of the border so the fill never exceeds the longest integrated converge time of the time image
+                double min_time = point_at(rect.x_begin, rect.y_begin).converge_time;
+                double max_time = min_time;
+                for (unsigned int i = rect.x_begin; i < rect.x_end; i++) {
+                    min_time = std::min({min_time, double(point_at(i, rect.y_begin).converge_time), double(point_at(i, y_last).converge_time)});
+                    max_time = std::max({max_time, double(point_at(i, rect.y_begin).converge_time), double(point_at(i, y_last).converge_time)});
+                }
+                for (unsigned int j = rect.y_begin; j < rect.y_end; j++) {
+                    min_time = std::min({min_time, double(point_at(rect.x_begin, j).converge_time), double(point_at(x_last, j).converge_time)});
+                    max_time = std::max({max_time, double(point_at(rect.x_begin, j).converge_time), double(point_at(x_last, j).converge_time)});
+                }
+                auto interpolate = [&](unsigned int i, unsigned int j, double u, double v, double (*value)(const point_type &)) {
+                    return (1.0-v)*value(point_at(i, rect.y_begin)) + v*value(point_at(i, y_last))
+                            + (1.0-u)*value(point_at(rect.x_begin, j)) + u*value(point_at(x_last, j))
+                            - (1.0-u)*(1.0-v)*value(point_at(rect.x_begin, rect.y_begin)) - u*(1.0-v)*value(point_at(x_last, rect.y_begin))
+                            - (1.0-u)*v*value(point_at(rect.x_begin, y_last)) - u*v*value(point_at(x_last, y_last));
+                };
+                for (unsigned int j = rect.y_begin+1; j < y_last; j++) {
+                    const double v = double(j - rect.y_begin)/double(height-1);
+                    for (unsigned int i = rect.x_begin+1; i < x_last; i++) {
+                        if (verify_interval > 0 && ++fill_counter % verify_interval == 0) {
+                            add_point(i, j);
+                            verify_points.push_back(std::make_pair(grid_point(i, j), fill_position));
+                            continue;
+                        }
+                        const double u = double(i - rect.x_begin)/double(width-1);
+                        point_type the_point;
+                        the_point.converge_position = fill_position;
+                        the_point.converge_time = std::min(std::max(interpolate(i, j, u, v, [](const point_type &p) {return double(p.converge_time);}), min_time), max_time);
+                        the_point.step_count = unsigned(std::max(0.0, std::round(interpolate(i, j, u, v, [](const point_type &p) {return double(p.step_count);}))));
+                        the_map.set_point(the_map.index(i, j), the_point);
+                        statistics.filled_count++;
+                    }
+                }
+            } else if (width <= 4 || height <= 4) {
+                // too small to gain from splitting, integrate the interior
+                for (unsigned int j = rect.y_begin+1; j < y_last; j++) {
+                    for (unsigned int i = rect.x_begin+1; i < x_last; i++) {
+                        add_point(i, j);
+                    }
+                }
+            } else {
+                // split into quarters that share the middle row and column
+                const unsigned int x_mid = (rect.x_begin + x_last)/2;
+                const unsigned int y_mid = (rect.y_begin + y_last)/2;
+                next_rectangles.push_back(map_tile{rect.x_begin, x_mid+1, rect.y_begin, y_mid+1});
+                next_rectangles.push_back(map_tile{x_mid, rect.x_end, rect.y_begin, y_mid+1});
+                next_rectangles.push_back(map_tile{rect.x_begin, x_mid+1, y_mid, rect.y_end});
+                next_rectangles.push_back(map_tile{x_mid, rect.x_end, y_mid, rect.y_end});
+            }
+        }
 
-    //! Integrate map with a fixed integration time.
-    void fixed_integrate_map(const integrator_type &the_integrator, const pendulum_system &the_system, map_iter first, map_iter last) const;
+        // integrate the small interiors and the verification sample, then compare the sample with the fill
+        integrate_queued_points();
+        for (const auto &verify_point : verify_points) {
+            statistics.verified_count++;
+            statistics.verify_mismatch_count += (point_at(verify_point.first.first, verify_point.first.second).converge_position != verify_point.second) ? 1 : 0;
+        }
+        rectangles.swap(next_rectangles);
+    }
+}
 
-    //! Parallel integrate the map with a fixed integration time.
-    void fixed_parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const;
+template <typename integrator_type>
+template <typename point_source>
+void pendulum_map<integrator_type>::integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, point_source next_point, map_statistics &statistics) const
+{
+    // one dispatch on the attractor count for all the points, the integrators step the fixed size system. The traps and the cache
+    // owner are worked out once here, so the point loops allocate nothing
+    const std::vector<energy_trap> traps = energy_traps(the_system);
+    const std::uint64_t cache_owner = m_cache != nullptr ? convergence_cache_owner(the_system, the_integrator) : 0;
+    dispatch_step_system(the_system, [&](const auto &step_system) {
+        if (m_batch_mode) {
+            batch_integrate_points(the_integrator, the_system, step_system, the_map, next_point, statistics, traps, cache_owner, has_batch_step<integrator_type>());
+            return;
+        }
+        unsigned int i;
+        unsigned int j;
+        while (next_point(i, j)) {
+            point_type the_point;
+            integrate_point(the_integrator, the_system, step_system, the_map.start_state(i, j), the_point, &statistics, traps, cache_owner);
+            the_map.set_point(the_map.index(i, j), the_point);
+            statistics.add_point(the_point);
+        }
+    });
+}
 
-    // basic property modifiers for the map, integration and colors for attractors NOTE: must have a color assigned for each attractor or the image will not form correctly
-    //! Set the x and y start and end positions and the resolution.
-    void set_map(double x_start_position, double x_end_position, double y_start_position, double y_end_position, double resolution);
+template <typename integrator_type>
+template <typename step_system_type, typename point_source>
+void pendulum_map<integrator_type>::batch_integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, map_type &the_map, point_source next_point, map_statistics &statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner, std::true_type) const
+{
+    typedef std::array<double, batch_lanes> lane_array;
+    batch_state_type<batch_lanes> current_state;
+    lane_array t;
+    lane_array h;
+    std::array<int, batch_lanes> accepted;
 
-    //! Set the converge tolerance for stopping the integration.
-    void set_converge_tol(double position_tolerance, double mid_position_tolerance, double time_tolerance);
+    // per lane copies of the bookkeeping integrate_point keeps in local variables, the dwell start replaces the magnet_time vector
+    std::array<point_type, batch_lanes> lane_point;
+    std::array<std::size_t, batch_lanes> lane_index;
+    std::array<bool, batch_lanes> lane_active;
+    std::array<unsigned int, batch_lanes> trial_count;
+    std::array<unsigned int, batch_lanes> lane_rhs_evaluations; // instrumentation only
+    std::array<unsigned int, batch_lanes> current_magnet;
+    std::array<bool, batch_lanes> dwelling;
+    lane_array dwell_start;
+    const bool energy_policy = !traps.empty();
+    std::array<convergence_trail, batch_lanes> trail;
+    std::array<bool, batch_lanes> cache_hit;
+    std::array<unsigned int, batch_lanes> cache_position;
 
-    //! Set the thread count for parallel integration.
-    void set_thread_count(unsigned int nthreads);
+    const counting_system<step_system_type> counted_system(step_system);
+    step_memory<integrator_type> memory(m_step_controller);
 
-    //! Set the initial step size for the integrator.
-    void set_step_size(double step_size);
+    // idle lanes keep stepping a harmless state once the range runs out of points, their results are ignored
+    const state_type idle_state = {{0.5*the_system.L, 0.0, 0.0, 0.0}};
 
-    //! Set the end integration time (only used for fixed time integration).
-    void set_end_time(double end_time);
+    // points outside the pendulum length or at (0,0) are stored unset right away like integrate_point does
+    auto next_integrable_point = [&](std::size_t &index, state_type &start_state) {
+        unsigned int i;
+        unsigned int j;
+        while (next_point(i, j)) {
+            index = the_map.index(i, j);
+            start_state = the_map.start_state(i, j);
+            if (is_integrable(the_system, start_state)) {
+                return true;
+            }
+            const point_type unset_point;
+            the_map.set_point(index, unset_point);
+            statistics.add_point(unset_point);
+        }
+        return false;
+    };
 
-    //! Set the color for an attractor by its index.
-    void set_attractor_color(int index, int r, int g, int b);
+    // stream the next point into a lane, returns false when there is nothing left to integrate
+    auto load_lane = [&](std::size_t l) {
+        state_type start_state = idle_state;
+        lane_active[l] = next_integrable_point(lane_index[l], start_state);
+        if (!lane_active[l]) {
+            start_state = idle_state;
+        }
+        lane_point[l] = point_type();
+        for (std::size_t i = 0; i < start_state.size(); i++) {
+            current_state[i][l] = start_state[i];
+        }
+        t[l] = m_tstart;
+        h[l] = m_dt;
+        trial_count[l] = 0;
+        lane_rhs_evaluations[l] = 0;
+        current_magnet[l] = 0;
+        dwelling[l] = false;
+        trail[l].clear();
+        cache_hit[l] = false;
+        memory.start_lane(counted_system.step_system(), start_state, t[l], l);
+        if (m_automatic_initial_step) {
+            h[l] = initial_step(the_integrator, counted_system.step_system(), start_state, t[l], has_initial_step<integrator_type>());
+        }
+        return lane_active[l];
+    };
 
-    //! Add a color to the attractor color table.
-    void add_attractor_color(int r, int g, int b);
+    unsigned int active_lanes = 0;
+    for (std::size_t l = 0; l < batch_lanes; l++) {
+        active_lanes += load_lane(l);
+    }
 
-    //! Clear the color table.
-    void clear_attractor_colors();
+    while (active_lanes > 0) {
+        const unsigned long long step_rhs_evaluations = counted_system.count();
+        // the lockstep step vectorizes across lanes and runs fastest on the widest vectors, so it is dispatched on the instruction set.
+        // The lane bookkeeping and the point by point loop are latency bound and measured faster in the baseline build.
+        dispatch_cpu_isa(m_cpu_isa, [&]() {
+            memory.do_batch_step(the_integrator, counted_system.step_system(), current_state, t, h, accepted);
+        });
 
-    //! Set the color for points outside bounds.
-    void set_no_converge_color(int r, int g, int b);
+        for (std::size_t l = 0; l < batch_lanes; l++) {
+            if (!lane_active[l]) {
+                continue;
+            }
+            point_type &the_point = lane_point[l];
+            the_point.step_count += accepted[l];
+            trial_count[l]++;
+            if (instrumentation_enabled) {
+                lane_rhs_evaluations[l] += counted_system.count() - step_rhs_evaluations;
+            }
 
-    //! Set the color for points that converge to the middle.
-    void set_mid_converge_color(int r, int g, int b);
-private:
-    double m_res = 0.05; // resolution of the map
-    double m_xstart = -10.0; // start and end points for the map
-    double m_ystart = -10.0;
-    double m_xend = 10.0;
-    double m_yend = 10.0;
-    double m_tstart = 0.0; // starting integration time
-    double m_tend = 20.0; // end integration time (only used for fixed integrations)
-    double m_dt = 0.001; // starting integration step size
-    unsigned int m_min_group = 1; // minimum group size for threading
-    unsigned int m_nthreads = 32; // number of threads
-    double m_pos_tol = 0.5; // position tolerance for checking magnet convergence
-    double m_mid_tol = 0.1; // position tolerance for checking mid/gravity convergence
-    double m_time_tol = 5.0; // time tolerance for checking convergence
-    QVector<QRgb> attractor_colors; // index of colors to be assigned to the attractors
-    QRgb no_converge_color = qRgb(255, 255, 255); // color for points that are outside bounds or do not converge to the middle or attractors
-    QRgb mid_converge_color = qRgb(0, 0, 0); // color for points that converge to the middle
-};
+            // same convergence rules as integrate_point
+            bool converged = false;
+            const int position = near_position(the_system, current_state[0][l], current_state[1][l]);
+            if (position < 0) {
+                dwelling[l] = false;
+            } else if (current_magnet[l] == unsigned(position)) {
+                if (!dwelling[l]) {
+                    dwell_start[l] = t[l];
+                    dwelling[l] = true;
+                }
+                converged = (t[l] - dwell_start[l] >= m_time_tol);
+            } else {
+                current_magnet[l] = position;
+                dwell_start[l] = t[l];
+                dwelling[l] = true;
+            }
+            if (energy_policy && position >= 0 && !converged) {
+                const state_type lane_state = {{current_state[0][l], current_state[1][l], current_state[2][l], current_state[3][l]}};
+                converged = is_trapped(the_system, lane_state, position, traps);
+            }
+
+            if (converged) {
+                the_point.converge_time = t[l];
+                the_point.converge_position = position;
+            }
+            if (m_cache != nullptr && !converged) {
+                const state_type lane_state = {{current_state[0][l], current_state[1][l], current_state[2][l], current_state[3][l]}};
+                converged = check_cache(cache_owner, lane_state, t[l], trial_count[l], trail[l], cache_hit[l], cache_position[l], the_point);
+            }
+            if (converged || !(t[l] < 1000 && trial_count[l] < 1000000)) {
+                if (m_cache != nullptr) {
+                    finish_cache(cache_owner, trail[l], converged, cache_hit[l], cache_position[l], the_point, &statistics);
+                }
+                if (instrumentation_enabled) {
+                    const unsigned int rejected_steps = trial_count[l] - the_point.step_count;
+                    statistics.rejected_steps += rejected_steps;
+                    statistics.max_rejected_steps = std::max(statistics.max_rejected_steps, rejected_steps);
+                    statistics.rhs_evaluations += lane_rhs_evaluations[l];
+                }
+                the_map.set_point(lane_index[l], the_point);
+                statistics.add_point(the_point);
+                active_lanes -= !load_lane(l);
+            }
+        }
+    }
+}
 
 template <typename integrator_type>
-pendulum_map<integrator_type>::pendulum_map()
+template <typename step_system_type, typename point_source>
+void pendulum_map<integrator_type>::batch_integrate_points(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, map_type &the_map, point_source next_point, map_statistics &statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner, std::false_type) const
 {
-    attractor_colors.push_back(qRgb(255, 140, 0));
-    attractor_colors.push_back(qRgb(30, 144, 255));
-    attractor_colors.push_back(qRgb(178, 34, 34));
+    // integrator has no lockstep step, integrate point by point
+    unsigned int i;
+    unsigned int j;
+    while (next_point(i, j)) {
+        point_type the_point;
+        integrate_point(the_integrator, the_system, step_system, the_map.start_state(i, j), the_point, &statistics, traps, cache_owner);
+        the_map.set_point(the_map.index(i, j), the_point);
+        statistics.add_point(the_point);
+    }
 }
 
 template <typename integrator_type>
-void pendulum_map<integrator_type>::parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const
+double pendulum_map<integrator_type>::trap_barrier(const pendulum_system &the_system, int position, double &radius) const
 {
-    // multithreaded integration of the map
-    const unsigned int group = std::max(std::intptr_t(m_min_group), std::intptr_t((the_map.end()-the_map.begin())/m_nthreads));
-    std::vector<std::thread> threads;
-    threads.reserve(m_nthreads);
-    auto it = the_map.begin();
-    auto last = the_map.end();
-    // function pointer to resolve compiler parsing UPDATE: Lambda cleaner and no pointer cleanup needed (compiled on gcc 4.8.1)
-//    void (pendulum_map<integrator_type>::*fxn_ptr)(const integrator_type&, const pendulum_system&, map_iter, map_iter) const = &pendulum_map<integrator_type>::integrate_map;
-    for (; it < last-group; it += group) {
-//        threads.push_back(std::thread(fxn_ptr, this, std::ref(the_integrator), std::ref(the_system), it, std::min(it+group, last)));
-        threads.push_back(std::thread([=,&the_integrator,&the_system]() {integrate_map(the_integrator, the_system, it, std::min(it+group, last));}));
+    // the trap circle is inscribed in the near_position box and kept out of the boxes near_position checks first (lower attractor
+    // indices, all attractors for the middle), so a trapped head can only ever converge to this position with the dwell rule as well
+    const bool middle = (position == 254);
+    const double center_x = middle ? 0.0 : the_system.attractor_list()[position].x;
+    const double center_y = middle ? 0.0 : the_system.attractor_list()[position].y;
+    const unsigned int first_count = middle ? the_system.attractor_list().size() : position;
+    radius = middle ? m_mid_tol : m_pos_tol;
+    for (unsigned int i = 0; i < first_count; i++) {
+        const double box_dx = std::max(std::abs(the_system.attractor_list()[i].x - center_x) - m_pos_tol, 0.0);
+        const double box_dy = std::max(std::abs(the_system.attractor_list()[i].y - center_y) - m_pos_tol, 0.0);
+        radius = std::min(radius, std::sqrt(box_dx*box_dx + box_dy*box_dy));
     }
-    integrate_map(the_integrator, the_system, it, the_map.end()); // left over chunks while we wait for other threads
-    std::for_each(threads.begin(), threads.end(), [](std::thread& x){x.join();}); // wait for all threads to finish integrations
+    return the_system.potential_barrier(center_x, center_y, radius);
 }
 
 template <typename integrator_type>
-void pendulum_map<integrator_type>::save_integrated_map (pendulum_system &the_system, integrator_type &the_integrator, QString filename, QDomElement xml_element) const
+std::vector<typename pendulum_map<integrator_type>::energy_trap> pendulum_map<integrator_type>::energy_traps(const pendulum_system &the_system) const
 {
-    // timer for computation time
-    std::chrono::time_point<std::chrono::system_clock> start, end;
-    start = std::chrono::system_clock::now();
-    // dimensions of the map
-    const int xdim = std::abs(std::round((m_xend-m_xstart)/m_res))+1;
-    const int ydim = std::abs(std::round((m_yend-m_ystart)/m_res))+1;
-
-    // blocks of memory for images
-    uchar* position_solution_map = (uchar*)malloc(xdim * ydim);
-    uchar* time_solution_map = (uchar*)malloc(xdim * ydim);
-
-    //create map container and integrate the map
-    map_type integration_map = create_map_container();
-    parallel_integrate_map(the_system, the_integrator, integration_map);
-
-    // collect general information about the map
-    unsigned int buffer_index = 0;
-    unsigned int total_count = 0;
-    unsigned int mid_converge_count = 0;
-    unsigned int outside_bounds_count = 0;
-    double total_integration_time = 0.0;
-    unsigned long long total_steps = 0;
-    double max_time = 0;
-    for (int j = ydim-1; j >= 0; j--) { // starting at upper left of map (ymax, xmin) to fill the memory with the correct orientation for QImage
-        for (int i = 0; i < xdim; i++) {
-            position_solution_map[buffer_index] = integration_map[i][j].converge_position;
-            time_solution_map[buffer_index] = int(std::round(integration_map[i][j].converge_time));
-            if (max_time < integration_map[i][j].converge_time) {
-                max_time = integration_map[i][j].converge_time;
-            }
-            if (integration_map[i][j].converge_position == 255) {
-                outside_bounds_count++;
-            } else {
-                total_count++;
-                total_integration_time += integration_map[i][j].converge_time;
-                total_steps += integration_map[i][j].step_count;
-                if (integration_map[i][j].converge_position == 254) {
-                    mid_converge_count++;
-                }
-            }
-            buffer_index++;
-        }
+    std::vector<energy_trap> traps;
+    if (m_policy != convergence_policy::energy || the_system.b <= 0.0) {
+        return traps;
     }
+    // the barriers only depend on the system and the tolerances, so they are computed once per integration instead of per point
+    const unsigned int attractor_count = the_system.attractor_list().size();
+    traps.resize(attractor_count + 1);
+    for (unsigned int position = 0; position <= attractor_count; position++) {
+        traps[position].barrier = trap_barrier(the_system, position == attractor_count ? 254 : int(position), traps[position].radius);
+    }
+    return traps;
+}
 
-    double avg_integration_time = total_integration_time/double(total_count);
-    double avg_step_count = double(total_steps)/double(total_count);
-
-    end = std::chrono::system_clock::now();
-    std::chrono::duration<double> elapsed_seconds = end-start; // elapsed time for the process
-
-    xml_element.setAttribute("points_integrated", total_count);
-    xml_element.setAttribute("mid_converge_count", mid_converge_count);
-    xml_element.setAttribute("points_outside_bounds", outside_bounds_count);
-    xml_element.setAttribute("computation_time", elapsed_seconds.count());
-    xml_element.setAttribute("avg_integration_time", avg_integration_time);
-    xml_element.setAttribute("avg_number_of_steps", avg_step_count);
-    xml_element.setAttribute("max_integration_time", max_time);
-    std::cout << "\nTotal number of points: " << total_count << "\n";
-    std::cout << "Points outside bounds: " << outside_bounds_count << "\n";
-    std::cout << "Mid converge count: " << mid_converge_count << '\n';
-    std::cout << "Average integration time: " << avg_integration_time << '\n';
-    std::cout << "Average number of steps: " << avg_step_count << '\n';
-    std::cout << "Max integration time: " << max_time << '\n';
-    std::cout << "Elapsed time: " << elapsed_seconds.count() << "s\n";
+template <typename integrator_type>
+inline bool pendulum_map<integrator_type>::is_trapped(const pendulum_system &the_system, const state_type &state, int position, const std::vector<energy_trap> &traps) const
+{
+    const energy_trap &trap = traps[position == 254 ? traps.size() - 1 : std::size_t(position)];
+    const double dx = state[0] - (position == 254 ? 0.0 : the_system.attractor_list()[position].x);
+    const double dy = state[1] - (position == 254 ? 0.0 : the_system.attractor_list()[position].y);
+    return dx*dx + dy*dy < trap.radius*trap.radius && the_system.energy(state) < trap.barrier;
+}
 
-    QImage position_map_image(position_solution_map, xdim, ydim, xdim, QImage::Format_Indexed8);
-    position_map_image.setColorTable(attractor_colors);
-    position_map_image.setColor(254, mid_converge_color);
-    position_map_image.setColor(255, no_converge_color);
-    position_map_image.save("position_map" + filename + ".png");
+template <typename integrator_type>
+std::uint64_t pendulum_map<integrator_type>::convergence_cache_owner(const pendulum_system &the_system, const integrator_type &the_integrator) const
+{
+    // the tile cache key without the resolution and the flags that leave trajectories unchanged, so maps of any range, resolution or tiling share cells
+    map_file_header header = result_file_header(the_system, the_integrator);
+    header.resolution = 0.0;
+    header.flags &= map_file_energy_policy | map_file_pi_controller | map_file_automatic_initial_step | map_file_mixed_precision;
+    return tile_cache::fnv1a(tile_cache::make_key(header, the_system));
+}
 
-    QImage time_map_image(time_solution_map, xdim, ydim, xdim, QImage::Format_Indexed8);
-    for (unsigned int i = 0; i <= std::round(max_time); i++) {
-        int scale_factor = std::floor(255.0/std::round(max_time));
-        time_map_image.setColor(i, qRgb(255-i*scale_factor, 255-i*scale_factor, 255-i*scale_factor));
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::check_cache(std::uint64_t owner, const state_type &state, double t, unsigned int trial_count, convergence_trail &trail, bool &cache_hit, unsigned int &cache_position, point_type &the_point) const
+{
+    if (trial_count % cache_interval != 0) {
+        return false;
+    }
+    double remaining_time;
+    if (!cache_hit && m_cache->lookup(owner, state, cache_position, remaining_time)) {
+        cache_hit = true;
+        if (!m_verify_cache) {
+            // known territory, stop with the recorded converge position and extrapolate the converge time
+            the_point.converge_time = t + remaining_time;
+            the_point.converge_position = cache_position;
+            return true;
+        }
     }
-    time_map_image.save("time_map" + filename + ".png");
+    trail.add(state, t);
+    return false;
 }
 
 template <typename integrator_type>
-map_type pendulum_map<integrator_type>::create_map_container() const
+void pendulum_map<integrator_type>::finish_cache(std::uint64_t owner, const convergence_trail &trail, bool converged, bool cache_hit, unsigned int cache_position, const point_type &the_point, map_statistics *statistics) const
 {
-    const int xdim = std::round((m_xend-m_xstart)/m_res)+1;
-    const int ydim = std::round((m_yend-m_ystart)/m_res)+1;
-    int xdim_factor = std::round(m_xstart/m_res); // create int multipliers to fill array to avoid floating math rounding error
-    int ydim_factor = std::round(m_ystart/m_res);
+    // only trajectories that were integrated to convergence are recorded so cache errors do not spread
+    if (converged && (m_verify_cache || !cache_hit)) {
+        trail.record(*m_cache, owner, the_point.converge_position, the_point.converge_time);
+    }
+    if (statistics != nullptr && cache_hit) {
+        statistics->cache_hit_count++;
+        statistics->cache_agree_count += (m_verify_cache && cache_position == the_point.converge_position) ? 1 : 0;
+    }
+}
 
-    map_type integration_map(xdim, std::vector<point_type>(ydim));
-    for (int i = 0; i < xdim; i++) {
-        for (int j = 0; j < ydim; j++) {
-            integration_map[i][j].start_state[0] = double(xdim_factor)*m_res;
-            integration_map[i][j].start_state[1] = double(ydim_factor)*m_res;
-            integration_map[i][j].start_state[2] = 0.0;
-            integration_map[i][j].start_state[3] = 0.0;
-            ydim_factor++;
-        }
+template <typename integrator_type>
+inline bool pendulum_map<integrator_type>::is_integrable(const pendulum_system &the_system, const state_type &start_state) const
+{
+    return (std::sqrt(start_state[0]*start_state[0] + start_state[1]*start_state[1]) < (the_system.L - 1e-10))
+            && (std::abs(start_state[0]) > 1e-10 || std::abs(start_state[1]) > 1e-10);
+}
 
-        ydim_factor = std::round(m_ystart/m_res); // reset y value for next column
-        xdim_factor++;
-    }
+template <typename integrator_type>
+template <typename system>
+inline double pendulum_map<integrator_type>::initial_step(const integrator_type &the_integrator, const system &the_system, const state_type &start_state, double t, std::true_type) const
+{
+    return the_integrator.initial_step(the_system, start_state, t);
+}
 
-    return integration_map;
+template <typename integrator_type>
+template <typename system>
+inline double pendulum_map<integrator_type>::initial_step(const integrator_type &, const system &, const state_type &, double, std::false_type) const
+{
+    return m_dt;
 }
 
 template <typename integrator_type>
-void pendulum_map<integrator_type>::integrate_map(const integrator_type &the_integrator, const pendulum_system &the_system, map_iter first, map_iter last) const
+inline int pendulum_map<integrator_type>::near_position(const pendulum_system &the_system, double x, double y) const
 {
-    for (auto it = first; it != last; it++) {
-        for(auto it_inside = it->begin(); it_inside != it->end(); it_inside++) {
-            integrate_point(the_integrator, the_system, *it_inside);
+    for (unsigned int i = 0; i < the_system.attractor_list().size(); i++) {
+        if ((the_system.attractor_list()[i].x-m_pos_tol<x) && (x<the_system.attractor_list()[i].x+m_pos_tol) && (the_system.attractor_list()[i].y-m_pos_tol<y) && (y<the_system.attractor_list()[i].y+m_pos_tol)) {
+            return i;
         }
     }
+    if ((0.0 - m_mid_tol < x) && (x < 0.0 + m_mid_tol) && (0.0 - m_mid_tol < y) && (y < 0.0 + m_mid_tol)) {
+        return 254;
+    }
+    return -1;
 }
 
 template <typename integrator_type>
-inline void pendulum_map<integrator_type>::fixed_integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, point_type &the_point) const
+inline void pendulum_map<integrator_type>::fixed_integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const state_type &start_state, point_type &the_point) const
 {
     double t = m_tstart;
     double h = m_dt;
@@ -260,20 +1963,20 @@ inline void pendulum_map<integrator_type>::fixed_integrate_point(const integrato
     unsigned int trial_count = 0;
 
     // check pendulum length boundary
-    if (std::sqrt(std::pow(the_point.start_state[0], 2.0) + std::pow(the_point.start_state[1], 2.0)) < (the_system.L - 1e-10)) {
-        const double absX = std::abs(the_point.start_state[0]);
-        const double absY = std::abs(the_point.start_state[1]);
+    if (std::sqrt(std::pow(start_state[0], 2.0) + std::pow(start_state[1], 2.0)) < (the_system.L - 1e-10)) {
+        const double absX = std::abs(start_state[0]);
+        const double absY = std::abs(start_state[1]);
         // avoid undefined point at (0,0)
         if(absX > 1e-10 || absY > 1e-10) {
             // integration good to go, create local state for integration to keep start state
-            state_type current_state = the_point.start_state;
+            state_type current_state = start_state;
             while (t < m_tend && trial_count < 1000000 ) {
                 the_point.step_count += the_integrator.do_step(the_system, current_state, t, h);
                 trial_count++;
             }
 
-            for (unsigned int i = 0; i < the_system.attractor_list.size(); i++) {
-                if ((the_system.attractor_list[i].x-m_pos_tol<current_state[0]) && (current_state[0]<the_system.attractor_list[i].x+m_pos_tol) && (the_system.attractor_list[i].y-m_pos_tol<current_state[1]) && (current_state[1]<the_system.attractor_list[i].y+m_pos_tol)) {
+            for (unsigned int i = 0; i < the_system.attractor_list().size(); i++) {
+                if ((the_system.attractor_list()[i].x-m_pos_tol<current_state[0]) && (current_state[0]<the_system.attractor_list()[i].x+m_pos_tol) && (the_system.attractor_list()[i].y-m_pos_tol<current_state[1]) && (current_state[1]<the_system.attractor_list()[i].y+m_pos_tol)) {
                     the_point.converge_position = i;
                     return;
                 }
@@ -288,96 +1991,123 @@ inline void pendulum_map<integrator_type>::fixed_integrate_point(const integrato
 }
 
 template <typename integrator_type>
-void pendulum_map<integrator_type>::fixed_integrate_map(const integrator_type &the_integrator, const pendulum_system &the_system, map_iter first, map_iter last) const
+map_statistics pendulum_map<integrator_type>::fixed_parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const
+{
+    return parallel_tiles(the_map, [&](const map_tile &tile, map_statistics &statistics) {fixed_integrate_tile(the_integrator, the_system, the_map, tile, statistics);});
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::fixed_integrate_tile(const integrator_type &the_integrator, const pendulum_system &the_system, map_type &the_map, const map_tile &tile, map_statistics &statistics) const
 {
-    for (auto it = first; it != last; it++) {
-        for(auto it_inside = it->begin(); it_inside != it->end(); it_inside++) {
-            fixed_integrate_point(the_integrator, the_system, *it_inside);
+    for (unsigned int j = tile.y_begin; j < tile.y_end; j++) {
+        for (unsigned int i = tile.x_begin; i < tile.x_end; i++) {
+            point_type the_point;
+            fixed_integrate_point(the_integrator, the_system, the_map.start_state(i, j), the_point);
+            the_map.set_point(the_map.index(i, j), the_point);
+            statistics.add_point(the_point);
         }
     }
 }
 
 template <typename integrator_type>
-void pendulum_map<integrator_type>::fixed_parallel_integrate_map(const pendulum_system &the_system, const integrator_type &the_integrator, map_type &the_map) const
+void pendulum_map<integrator_type>::integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const state_type &start_state, point_type &the_point, map_statistics *statistics) const
+{
+    const std::vector<energy_trap> traps = energy_traps(the_system);
+    const std::uint64_t cache_owner = m_cache != nullptr ? convergence_cache_owner(the_system, the_integrator) : 0;
+    dispatch_step_system(the_system, [&](const auto &step_system) {
+        integrate_point(the_integrator, the_system, step_system, start_state, the_point, statistics, traps, cache_owner);
+    });
+}
+
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::float_derivatives(const pendulum_system &the_system) const
+{
+    const std::size_t attractor_count = the_system.attractor_list().size();
+    return m_precision == integration_precision::mixed && attractor_count >= 1 && attractor_count <= max_fixed_attractor_count;
+}
+
+template <typename integrator_type>
+template <typename function>
+void pendulum_map<integrator_type>::dispatch_step_system(const pendulum_system &the_system, function &&f) const
 {
-    const unsigned int group = std::max(std::intptr_t(m_min_group), std::intptr_t((the_map.end()-the_map.begin())/m_nthreads));
-    std::vector<std::thread> threads;
-    threads.reserve(m_nthreads);
-    auto it = the_map.begin();
-    auto last = the_map.end();
-    for (; it < last-group; it += group) {
-        threads.push_back(std::thread([=,&the_integrator,&the_system]() {fixed_integrate_map(the_integrator, the_system, it, std::min(it+group, last));}));
+    if (m_precision == integration_precision::mixed) {
+        dispatch_attractor_count<float>(the_system, f);
+    } else {
+        dispatch_attractor_count<double>(the_system, f);
     }
-    fixed_integrate_map(the_integrator, the_system, it, the_map.end());
-    std::for_each(threads.begin(), threads.end(), [](std::thread& x){x.join();});
 }
 
 template <typename integrator_type>
-inline void pendulum_map<integrator_type>::integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, point_type &the_point) const
+template <typename step_system_type>
+inline void pendulum_map<integrator_type>::integrate_point(const integrator_type &the_integrator, const pendulum_system &the_system, const step_system_type &step_system, const state_type &start_state, point_type &the_point, map_statistics *statistics, const std::vector<energy_trap> &traps, std::uint64_t cache_owner) const
 {
     double t = m_tstart;
     double h = m_dt;
     unsigned int trial_count = 0;
 
     // check pendulum length boundary
-    if (std::sqrt(std::pow(the_point.start_state[0], 2.0) + std::pow(the_point.start_state[1], 2.0)) < (the_system.L - 1e-10)) {
-        const double absX = std::abs(the_point.start_state[0]);
-        const double absY = std::abs(the_point.start_state[1]);
+    if (std::sqrt(std::pow(start_state[0], 2.0) + std::pow(start_state[1], 2.0)) < (the_system.L - 1e-10)) {
+        const double absX = std::abs(start_state[0]);
+        const double absY = std::abs(start_state[1]);
         // avoid undefined point at (0,0)
         if(absX > 1e-10 || absY > 1e-10) {
             // integration good to go, create local state for integration to keep start state and hopefully optimize memory rather than calling a member variable every time
-            state_type current_state = the_point.start_state;
+            state_type current_state = start_state;
             bool converged = false;
-            std::vector<double> magnet_time;
-            bool near_magnet = false;
+            bool dwelling = false; // head near current_magnet since dwell_start, replaces a vector of the times spent near it
+            double dwell_start = 0.0;
             unsigned int current_magnet = 0;
+            const bool energy_policy = !traps.empty();
+            convergence_trail trail;
+            bool cache_hit = false;
+            unsigned int cache_position = 0;
+            const counting_system<step_system_type> counted_system(step_system);
+            step_memory<integrator_type> memory(m_step_controller);
+            memory.start(counted_system.step_system(), current_state, t);
+            if (m_automatic_initial_step) {
+                h = initial_step(the_integrator, counted_system.step_system(), current_state, t, has_initial_step<integrator_type>());
+            }
             while (!converged && t < 1000 && trial_count < 1000000 ) {
-                the_point.step_count += the_integrator.do_step(the_system, current_state, t, h);
+                the_point.step_count += memory.do_step(the_integrator, counted_system.step_system(), current_state, t, h);
                 trial_count++;
-                near_magnet = false;
-
-                // check if pendulum head near an attractor and if it's been near for long enough time to consider converged
-                for (unsigned int i = 0; i < the_system.attractor_list.size(); i++) {
-                    if ((the_system.attractor_list[i].x-m_pos_tol<current_state[0]) && (current_state[0]<the_system.attractor_list[i].x+m_pos_tol) && (the_system.attractor_list[i].y-m_pos_tol<current_state[1]) && (current_state[1]<the_system.attractor_list[i].y+m_pos_tol)) {
-                        near_magnet = true;
-                        if (current_magnet == i) {
-                            magnet_time.push_back(t);
-                            if (magnet_time.back() - magnet_time.front() >= m_time_tol) {
-                                magnet_time.clear();
-                                the_point.converge_time = t;
-                                the_point.converge_position = i;
-                                converged = true;
-                            }
-                        } else {
-                            magnet_time.clear();
-                            current_magnet = i;
-                            magnet_time.push_back(t);
-                        }
-                        break;
+
+                // check if pendulum head near an attractor or the middle and if it's been near for long enough time to consider converged
+                const int position = near_position(the_system, current_state[0], current_state[1]);
+                if (position < 0) {
+                    dwelling = false;
+                } else if (current_magnet == unsigned(position)) {
+                    if (!dwelling) {
+                        dwell_start = t;
+                        dwelling = true;
                     }
+                    converged = (t - dwell_start >= m_time_tol);
+                } else {
+                    current_magnet = position;
+                    dwell_start = t;
+                    dwelling = true;
                 }
-                if (!near_magnet) {
-                    // check if pendulum head near middle
-                    if ((0.0 - m_mid_tol < current_state[0]) && (current_state[0] < 0.0 + m_mid_tol) && (0.0 - m_mid_tol < current_state[1]) && (current_state[1] < 0.0 + m_mid_tol)) {
-                        near_magnet = true;
-                        if (current_magnet == 254) {
-                            magnet_time.push_back(t);
-                            if (magnet_time.back() - magnet_time.front() >= m_time_tol) {
-                                magnet_time.clear();
-                                the_point.converge_time = t;
-                                the_point.converge_position = 254;
-                                converged = true;
-                            }
-                        } else {
-                            magnet_time.clear();
-                            current_magnet = 254;
-                            magnet_time.push_back(t);
-                        }
-                    } else {
-                        // not near middle or any attractor
-                        magnet_time.clear();
-                    }
+
+                // energy policy (heuristic, see convergence_policy): converged as soon as the head is below the potential barrier of the well it is in
+                if (energy_policy && position >= 0 && !converged) {
+                    converged = is_trapped(the_system, current_state, position, traps);
+                }
+
+                if (converged) {
+                    the_point.converge_time = t;
+                    the_point.converge_position = position;
                 }
+                if (m_cache != nullptr && !converged) {
+                    converged = check_cache(cache_owner, current_state, t, trial_count, trail, cache_hit, cache_position, the_point);
+                }
+            }
+            if (m_cache != nullptr) {
+                finish_cache(cache_owner, trail, converged, cache_hit, cache_position, the_point, statistics);
+            }
+            if (instrumentation_enabled && statistics != nullptr) {
+                const unsigned int rejected_steps = trial_count - the_point.step_count;
+                statistics->rejected_steps += rejected_steps;
+                statistics->max_rejected_steps = std::max(statistics->max_rejected_steps, rejected_steps);
+                statistics->rhs_evaluations += counted_system.count();
             }
         }
     }
@@ -410,12 +2140,126 @@ void pendulum_map<integrator_type>::set_thread_count(unsigned int nthreads)
     m_nthreads = nthreads;
 }
 
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_thread_pool(thread_pool *pool)
+{
+    m_pool = pool;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_image_writer(image_writer *writer)
+{
+    m_image_writer = writer;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_result_file(bool result_file)
+{
+    m_result_file = result_file;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_streaming(bool streaming, unsigned int band_height)
+{
+    m_streaming = streaming;
+    m_band_height = band_height;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_checkpointing(bool resume, double checkpoint_interval)
+{
+    m_resume = resume;
+    m_checkpoint_interval = checkpoint_interval;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_tile_size(unsigned int tile_width, unsigned int tile_height)
+{
+    m_tile_width = tile_width;
+    m_tile_height = tile_height;
+}
+
 template <typename integrator_type>
 void pendulum_map<integrator_type>::set_step_size(double step_size)
 {
     m_dt = step_size;
 }
 
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_batch_mode(bool batch_mode)
+{
+    m_batch_mode = batch_mode;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_step_controller(step_controller controller)
+{
+    m_step_controller = controller;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_automatic_initial_step(bool automatic_initial_step)
+{
+    m_automatic_initial_step = automatic_initial_step;
+}
+
+template <typename integrator_type>
+bool pendulum_map<integrator_type>::set_shard(unsigned int shard_index, unsigned int shard_count)
+{
+    if (shard_count == 0 || shard_index >= shard_count) {
+        std::cout << "Invalid shard " << shard_index << " of " << shard_count << ", the shard index must be below a nonzero shard count\n";
+        return false;
+    }
+    m_shard_count = shard_count;
+    m_shard_index = shard_index;
+    return true;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_convergence_policy(convergence_policy policy)
+{
+    m_policy = policy;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_precision(integration_precision precision)
+{
+    m_precision = precision;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_cpu_isa(cpu_isa isa)
+{
+    m_cpu_isa = std::min(isa, selected_cpu_isa());
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_convergence_cache(convergence_cache *cache, bool verify_cache)
+{
+    m_cache = cache;
+    m_verify_cache = verify_cache;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_symmetry(bool symmetry, double tolerance)
+{
+    m_symmetry = symmetry;
+    m_symmetry_tolerance = tolerance;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_boundary_tracing(bool boundary_tracing, double verify_fraction)
+{
+    m_boundary_tracing = boundary_tracing;
+    m_verify_fraction = verify_fraction;
+}
+
+template <typename integrator_type>
+void pendulum_map<integrator_type>::set_tile_cache(tile_cache *cache)
+{
+    m_tile_cache = cache;
+}
+
 template <typename integrator_type>
 void pendulum_map<integrator_type>::set_end_time(double end_time)
 {
@@ -5,9 +5,34 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
 
 typedef std::array< double , 4 > state_type;
 
+//! Number of points advanced together by the lockstep batch integrators, 8 doubles fill one AVX-512 register or two AVX2 registers.
+const std::size_t batch_lanes = 8;
+
+//! Structure of arrays state for a batch of points, indexed as [state component][lane] so each component is contiguous across lanes.
+template <std::size_t lanes>
+using batch_state_type = std::array< std::array< double , lanes > , 4 >;
+
+/*!
+ * \brief Rotation or reflection about the origin that maps every attractor of a system onto an attractor of equal strength, see pendulum_system::symmetries.
+ *
+ * \details Apart from the attractors the system is rotationally symmetric about the origin, so the trajectory from the image of a start
+ * position at rest is the image of its trajectory and converges to the image of its attractor.
+ */
+struct attractor_symmetry
+{
+    double xx; // (x, y) maps to (xx*x + xy*y, yx*x + yy*y), an orthogonal matrix
+    double xy;
+    double yx;
+    double yy;
+    std::vector<unsigned int> permutation; // attractor i maps onto attractor permutation[i]
+};
+
 //! Pendulum function object that returns the derivative of the current state.
 
 /*! The pendulum system is described by the following system of differential equations:
@@ -44,13 +69,19 @@ public:
     double g = 9.8; /*!< Acceleration due to gravity. */
     double b = 0.2; /*!< Linear drag coefficient. */
     double L = 10.0; /*!< Length of the pendulum. */
-    std::vector<attractor> attractor_list; /*!< List of attractors for the system. */
+
+    //! Attractor count from which operator() sums the attractor forces from the padded structure of arrays store, vectorized across attractors.
+    static constexpr std::size_t simd_attractor_threshold = 8;
+
+    //! Attractors summed per vector block in the structure of arrays path, 4 doubles fill one AVX2 register.
+    static constexpr std::size_t simd_attractor_width = 4;
 
     //! Default constructor sets k = 1.0 for three attractors positioned at: \f$(-0.5, \sqrt{3}/2)\f$, \f$(-0.5, -\sqrt{3}/2)\f$, and \f$(1, 0)\f$.
     pendulum_system() {
-        attractor_list.push_back(attractor{-0.5, sqrt(3.0)/2.0, 1.0});
-        attractor_list.push_back(attractor{-0.5, -sqrt(3.0)/2.0, 1.0});
-        attractor_list.push_back(attractor{1.0, 0.0, 1.0});
+        m_attractor_list.push_back(attractor{-0.5, sqrt(3.0)/2.0, 1.0});
+        m_attractor_list.push_back(attractor{-0.5, -sqrt(3.0)/2.0, 1.0});
+        m_attractor_list.push_back(attractor{1.0, 0.0, 1.0});
+        update_attractor_store();
     }
 
     //! Function call that returns the derivative of the current state.
@@ -58,6 +89,39 @@ public:
                     state_type &dxdt /*!< Derivative of the state, value modified by reference. */,
                     const double t /*!< Note: no time dependence. Parameter here to fit signature for integration.*/) const;
 
+    //! Function call that returns the derivative for a batch of states, evaluated lane by lane so the compiler can vectorize across points.
+    template <std::size_t lanes>
+    void operator()(const batch_state_type<lanes> &x /*!< Current batch of states. */,
+                    batch_state_type<lanes> &dxdt /*!< Derivatives of the states, value modified by reference. */,
+                    const std::array<double, lanes> &t /*!< Note: no time dependence. Parameter here to fit signature for integration.*/) const;
+
+    /*!
+     * \brief Potential energy of the head at (x, y), the sum of the gravity potential and the attractor potentials.
+     *
+     * \details Gravity is conservative with \f$U_g=-\frac{mgL}{3}\left(1-\frac{x^2+y^2}{L^2}\right)^{3/2}\f$. The attractor force is the gradient
+     * of \f$U_{a_n}=\frac{-k}{\sqrt{(x-x_n)^2+(y-y_n)^2+a^2}}\f$ only for a fixed height \f$a=d+L-\sqrt{L^2-(x^2+y^2)}\f$, the height is taken at
+     * the head position so the attractor part neglects the work done through the varying height. The force is
+     * \f$-\nabla U+\sum_n\frac{k\,a\nabla a}{\left[(x-x_n)^2+(y-y_n)^2+a^2\right]^{3/2}}\f$, the second term is not a gradient, so the
+     * attractor forces are not conservative and the energy is not a Lyapunov function of the system: damping takes energy out but the
+     * height term can put a little back in. It is small near an attractor close to the rest position, where \f$\nabla a\f$ is small.
+     */
+    double potential_energy(double x, double y) const;
+
+    //! Total mechanical energy of a state, kinetic energy plus pendulum_system::potential_energy. Damping makes it decrease over time.
+    double energy(const state_type &x) const;
+
+    /*!
+     * \brief Lower bound of the potential energy on the circle of radius around (x, y), from sample_count arcs.
+     *
+     * \details Each arc is bounded by the lower of the potential energies at its ends minus half its length times a bound of the potential
+     * gradient on it, so the result is never above the true minimum of the rim. If the total energy were conserved up to damping a head
+     * inside the circle with less energy could not leave it, see potential_energy for why that only holds approximately.
+     */
+    double potential_barrier(double x, double y, double radius, unsigned int sample_count = 256) const;
+
+    //! List of attractors for the system, modified through the attractor member functions so the SIMD attractor store stays in sync.
+    const std::vector<attractor> &attractor_list() const { return m_attractor_list; }
+
     //! Add an attractor at position (x_position, y_position) with attractive force coefficient attraction_strength.
     void add_attractor(double x_position, double y_position, double attraction_strength);
 
@@ -69,10 +133,41 @@ public:
 
     //! Clear all attractors.
     void clear_attractors();
+
+    /*!
+     * \brief Rotations and reflections about the origin that map every attractor onto an attractor with the same strength, positions and strengths compared within tolerance.
+     *
+     * \details The identity comes first. Candidates map the first attractor away from the origin onto each attractor at its radius with
+     * its strength, by rotation and by reflection, and are kept if they map all the attractors. Without attractors away from the origin
+     * every rotation is a symmetry and the eight that map the square grid of a map onto itself are returned.
+     */
+    std::vector<attractor_symmetry> symmetries(double tolerance = 1e-9) const;
+private:
+    //! Attractors as structure of arrays padded with k = 0 entries to a multiple of simd_attractor_width, so the force sum vectorizes with no remainder loop.
+    struct attractor_store {
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> k;
+        std::size_t count = 0; // number of real attractors
+    };
+    std::vector<attractor> m_attractor_list;
+    attractor_store m_attractor_store;
+
+    // rebuild the attractor store from the attractor list, called by every attractor member function
+    void update_attractor_store();
+
+    // derivative computed with the force sum over the attractor store, used by operator() from simd_attractor_threshold attractors
+    void store_derivative(const state_type &x, state_type &dxdt) const;
 };
 
 inline void pendulum_system::operator() (const state_type &x, state_type &dxdt, const double /* t */) const
 {
+    if (m_attractor_store.count >= simd_attractor_threshold) {
+        // many attractors: vectorized force sum over the attractor store, kept out of line so this path still inlines into the integrators
+        store_derivative(x, dxdt);
+        return;
+    }
+
     const double x_squared = x[0]*x[0];
     const double y_squared = x[1]*x[1];
     const double L_squared = L*L;
@@ -86,18 +181,11 @@ inline void pendulum_system::operator() (const state_type &x, state_type &dxdt,
     const double a_value = (d+L-sqrt(L_squared-norm_squared));
     const double a_value_squared = a_value*a_value;
 
-    double ax_value;
-    double ay_value;
-    double ax_value_squared;
-    double ay_value_squared;
-    double a_denom;
-    for (auto attractor : attractor_list) {
-        ax_value = x[0]-attractor.x;
-        ay_value = x[1]-attractor.y;
-        ax_value_squared = ax_value*ax_value;
-        ay_value_squared = ay_value*ay_value;
-        a_denom = -attractor.k/pow(ax_value_squared+ay_value_squared+a_value_squared,1.5);
-
+    for (const auto &attractor : m_attractor_list) {
+        const double ax_value = x[0]-attractor.x;
+        const double ay_value = x[1]-attractor.y;
+        const double distance_squared = ax_value*ax_value+ay_value*ay_value+a_value_squared;
+        const double a_denom = -attractor.k/(distance_squared*sqrt(distance_squared));
         f_m_x += ax_value*a_denom;
         f_m_y += ay_value*a_denom;
     }
@@ -108,28 +196,409 @@ inline void pendulum_system::operator() (const state_type &x, state_type &dxdt,
     dxdt[3] = (x[1]*g_value - b*x[3] + f_m_y) / m;
 }
 
+template <std::size_t lanes>
+inline void pendulum_system::operator() (const batch_state_type<lanes> &x, batch_state_type<lanes> &dxdt, const std::array<double, lanes> & /* t */) const
+{
+    const double L_squared = L*L;
+
+    std::array<double, lanes> g_value;
+    std::array<double, lanes> a_value_squared;
+    std::array<double, lanes> f_m_x;
+    std::array<double, lanes> f_m_y;
+    for (std::size_t l = 0; l < lanes; l++) {
+        const double norm_squared = x[0][l]*x[0][l] + x[1][l]*x[1][l];
+        g_value[l] = -m*g/L * sqrt(1.0 - norm_squared/L_squared);
+        const double a_value = (d+L-sqrt(L_squared-norm_squared));
+        a_value_squared[l] = a_value*a_value;
+        f_m_x[l] = 0.0;
+        f_m_y[l] = 0.0;
+    }
+
+    // attractors in the outer loop so the inner loop runs across lanes with no dependencies
+    for (const auto &attractor : m_attractor_list) {
+        for (std::size_t l = 0; l < lanes; l++) {
+            const double ax_value = x[0][l]-attractor.x;
+            const double ay_value = x[1][l]-attractor.y;
+            const double distance_squared = ax_value*ax_value+ay_value*ay_value+a_value_squared[l];
+            const double a_denom = -attractor.k/(distance_squared*sqrt(distance_squared));
+            f_m_x[l] += ax_value*a_denom;
+            f_m_y[l] += ay_value*a_denom;
+        }
+    }
+
+    for (std::size_t l = 0; l < lanes; l++) {
+        dxdt[0][l] = x[2][l];
+        dxdt[1][l] = x[3][l];
+        dxdt[2][l] = (x[0][l]*g_value[l] - b*x[2][l] + f_m_x[l]) / m;
+        dxdt[3][l] = (x[1][l]*g_value[l] - b*x[3][l] + f_m_y[l]) / m;
+    }
+}
+
+double pendulum_system::potential_energy(double x, double y) const
+{
+    const double L_squared = L*L;
+    const double norm_squared = x*x + y*y;
+    const double height_factor = 1.0 - norm_squared/L_squared;
+    double energy = -m*g*L/3.0 * height_factor*sqrt(height_factor);
+
+    const double a_value = (d+L-sqrt(L_squared-norm_squared));
+    const double a_value_squared = a_value*a_value;
+    for (const auto &attractor : m_attractor_list) {
+        const double ax_value = x-attractor.x;
+        const double ay_value = y-attractor.y;
+        energy -= attractor.k/sqrt(ax_value*ax_value+ay_value*ay_value+a_value_squared);
+    }
+    return energy;
+}
+
+double pendulum_system::energy(const state_type &x) const
+{
+    return 0.5*m*(x[2]*x[2] + x[3]*x[3]) + potential_energy(x[0], x[1]);
+}
+
+double pendulum_system::potential_barrier(double x, double y, double radius, unsigned int sample_count) const
+{
+    const double pi = 3.14159265358979323846;
+    sample_count = std::max(sample_count, 3u);
+    const double arc_length = 2.0*pi*radius/sample_count;
+    double barrier = std::numeric_limits<double>::infinity();
+    double start_energy = potential_energy(x+radius, y);
+    for (unsigned int i = 1; i <= sample_count; i++) {
+        const double angle = 2.0*pi*i/sample_count;
+        const double end_energy = potential_energy(x+radius*cos(angle), y+radius*sin(angle));
+
+        // every point of the arc lies within half an arc length of the middle of its chord and of one of its ends
+        const double middle_angle = 2.0*pi*(i-0.5)/sample_count;
+        const double middle_x = x+radius*cos(middle_angle);
+        const double middle_y = y+radius*sin(middle_angle);
+        const double max_norm = sqrt(middle_x*middle_x + middle_y*middle_y) + 0.5*arc_length;
+        if (max_norm >= L) {
+            return -std::numeric_limits<double>::infinity(); // the arc reaches the pendulum length, no bound
+        }
+
+        // |grad U_g| <= mg r/L and |grad U_a_n| <= k(1+|grad a|)/(rho^2+a^2) with a >= d and |grad a| = r/sqrt(L^2-r^2)
+        const double height_slope = max_norm/sqrt(L*L - max_norm*max_norm);
+        double gradient_bound = m*g*max_norm/L;
+        for (const auto &attractor : m_attractor_list) {
+            const double distance = std::max(std::hypot(middle_x-attractor.x, middle_y-attractor.y) - 0.5*arc_length, 0.0);
+            gradient_bound += std::abs(attractor.k)*(1.0+height_slope)/(distance*distance + d*d);
+        }
+        barrier = std::min(barrier, std::min(start_energy, end_energy) - 0.5*arc_length*gradient_bound);
+        start_energy = end_energy;
+    }
+    return barrier;
+}
+
 void pendulum_system::add_attractor(double x_position, double y_position, double attraction_strength = 1.0)
 {
-    attractor_list.push_back(attractor{x_position, y_position, attraction_strength});
+    m_attractor_list.push_back(attractor{x_position, y_position, attraction_strength});
+    update_attractor_store();
 }
 
 void pendulum_system::set_attractor(int index, double x_position, double y_position, double attraction_strength)
 {
-    attractor_list[index].x = x_position;
-    attractor_list[index].y = y_position;
-    attractor_list[index].k = attraction_strength;
+    m_attractor_list[index].x = x_position;
+    m_attractor_list[index].y = y_position;
+    m_attractor_list[index].k = attraction_strength;
+    update_attractor_store();
 }
 
 void pendulum_system::set_all_attractor_strengths(double attraction_strength)
 {
-    for (auto &attractor : attractor_list) {
+    for (auto &attractor : m_attractor_list) {
         attractor.k = attraction_strength;
     }
+    update_attractor_store();
 }
 
 void pendulum_system::clear_attractors()
 {
-    attractor_list.clear();
+    m_attractor_list.clear();
+    update_attractor_store();
 }
 
+std::vector<attractor_symmetry> pendulum_system::symmetries(double tolerance) const
+{
+    std::vector<std::array<double, 4>> candidates{{{1.0, 0.0, 0.0, 1.0}}};
+    const auto reference = std::find_if(m_attractor_list.begin(), m_attractor_list.end(), [&](const attractor &the_attractor) {
+        return std::hypot(the_attractor.x, the_attractor.y) > tolerance;
+    });
+    if (reference == m_attractor_list.end()) {
+        // rotations by quarter turns and reflections about the axes and diagonals
+        candidates.insert(candidates.end(), {{{0.0, -1.0, 1.0, 0.0}}, {{-1.0, 0.0, 0.0, -1.0}}, {{0.0, 1.0, -1.0, 0.0}},
+                                             {{1.0, 0.0, 0.0, -1.0}}, {{-1.0, 0.0, 0.0, 1.0}}, {{0.0, 1.0, 1.0, 0.0}}, {{0.0, -1.0, -1.0, 0.0}}});
+    } else {
+        const double reference_radius = std::hypot(reference->x, reference->y);
+        const double reference_angle = std::atan2(reference->y, reference->x);
+        for (auto it = m_attractor_list.begin(); it != m_attractor_list.end(); ++it) {
+            if (std::abs(std::hypot(it->x, it->y) - reference_radius) > tolerance || std::abs(it->k - reference->k) > tolerance) {
+                continue;
+            }
+            const double angle = std::atan2(it->y, it->x);
+            if (it != reference) {
+                const double rotation = angle - reference_angle;
+                candidates.push_back({{std::cos(rotation), -std::sin(rotation), std::sin(rotation), std::cos(rotation)}});
+            }
+            // reflection about the line halfway between the two attractors
+            const double reflection = angle + reference_angle;
+            candidates.push_back({{std::cos(reflection), std::sin(reflection), std::sin(reflection), -std::cos(reflection)}});
+        }
+    }
+
+    std::vector<attractor_symmetry> result;
+    for (auto &candidate : candidates) {
+        // quarter turns within the tolerance are made exact so they map grid points onto grid points
+        for (double &entry : candidate) {
+            const double rounded = std::round(entry);
+            entry = std::abs(entry - rounded) <= tolerance ? rounded : entry;
+        }
+        attractor_symmetry symmetry{candidate[0], candidate[1], candidate[2], candidate[3], std::vector<unsigned int>()};
+        std::vector<char> taken(m_attractor_list.size(), 0);
+        for (const auto &the_attractor : m_attractor_list) {
+            const double image_x = symmetry.xx*the_attractor.x + symmetry.xy*the_attractor.y;
+            const double image_y = symmetry.yx*the_attractor.x + symmetry.yy*the_attractor.y;
+            for (unsigned int j = 0; j < m_attractor_list.size(); j++) {
+                if (!taken[j] && std::hypot(m_attractor_list[j].x - image_x, m_attractor_list[j].y - image_y) <= tolerance
+                        && std::abs(m_attractor_list[j].k - the_attractor.k) <= tolerance) {
+                    taken[j] = 1;
+                    symmetry.permutation.push_back(j);
+                    break;
+                }
+            }
+        }
+        if (symmetry.permutation.size() == m_attractor_list.size()) {
+            result.push_back(symmetry);
+        }
+    }
+    return result;
+}
+
+void pendulum_system::store_derivative(const state_type &x, state_type &dxdt) const
+{
+    const double L_squared = L*L;
+    const double norm_squared = x[0]*x[0] + x[1]*x[1];
+    const double g_value = -m*g/L * sqrt(1.0 - norm_squared/L_squared);
+    const double a_value = (d+L-sqrt(L_squared-norm_squared));
+    const double a_value_squared = a_value*a_value;
+
+    // one block of simd_attractor_width attractors at a time with per lane partial sums, the fixed width inner loop
+    // vectorizes and padding entries have k = 0 so they contribute nothing
+    const double *attractor_x = m_attractor_store.x.data();
+    const double *attractor_y = m_attractor_store.y.data();
+    const double *attractor_k = m_attractor_store.k.data();
+    const std::size_t padded_count = m_attractor_store.k.size();
+    std::array<double, simd_attractor_width> lane_f_m_x = {};
+    std::array<double, simd_attractor_width> lane_f_m_y = {};
+    for (std::size_t n = 0; n < padded_count; n += simd_attractor_width) {
+        for (std::size_t l = 0; l < simd_attractor_width; l++) {
+            const double ax_value = x[0]-attractor_x[n+l];
+            const double ay_value = x[1]-attractor_y[n+l];
+            const double inv_distance = 1.0/sqrt(ax_value*ax_value+ay_value*ay_value+a_value_squared);
+            const double a_denom = -attractor_k[n+l]*inv_distance*inv_distance*inv_distance;
+            lane_f_m_x[l] += ax_value*a_denom;
+            lane_f_m_y[l] += ay_value*a_denom;
+        }
+    }
+    double f_m_x = 0.0;
+    double f_m_y = 0.0;
+    for (std::size_t l = 0; l < simd_attractor_width; l++) {
+        f_m_x += lane_f_m_x[l];
+        f_m_y += lane_f_m_y[l];
+    }
+
+    dxdt[0] = x[2];
+    dxdt[1] = x[3];
+    dxdt[2] = (x[0]*g_value - b*x[2] + f_m_x) / m;
+    dxdt[3] = (x[1]*g_value - b*x[3] + f_m_y) / m;
+}
+
+void pendulum_system::update_attractor_store()
+{
+    const std::size_t padded_count = (m_attractor_list.size() + simd_attractor_width - 1)/simd_attractor_width*simd_attractor_width;
+    m_attractor_store.x.assign(padded_count, 0.0);
+    m_attractor_store.y.assign(padded_count, 0.0);
+    m_attractor_store.k.assign(padded_count, 0.0);
+    for (std::size_t n = 0; n < m_attractor_list.size(); n++) {
+        m_attractor_store.x[n] = m_attractor_list[n].x;
+        m_attractor_store.y[n] = m_attractor_list[n].y;
+        m_attractor_store.k[n] = m_attractor_list[n].k;
+    }
+    m_attractor_store.count = m_attractor_list.size();
+}
+
+//! Largest attractor count with a fixed_pendulum_system specialization, dispatch_attractor_count uses pendulum_system itself above it.
+const std::size_t max_fixed_attractor_count = 16;
+
+/*!
+ * \brief Copy of a pendulum_system with the attractor count fixed at compile time, for the derivative calls of the integrators.
+ *
+ * \details The attractors are held in std::array members as structure of arrays, so the force sum in operator() has a constant trip count
+ * the compiler unrolls and vectorizes across attractors, and the attractors stay in registers over a step instead of being loaded through
+ * the vector of pendulum_system. It computes the same derivative as pendulum_system::operator(). It is a snapshot: changes to the system
+ * after construction are not seen, build it from the system right before integrating, see dispatch_attractor_count.
+ *
+ * With real = float the derivative is computed in single precision from the state rounded to float and returned in double, so the
+ * integrators still step and accumulate the state in double (mixed precision). A batch then evaluates twice as many lanes per vector
+ * register and the attractors take half the space. The head height is computed in a form without the cancellation near rest, so the
+ * forces keep float accuracy, see pendulum_map::compare_precision for the effect on a map.
+ */
+template <std::size_t attractor_count, typename real = double>
+class fixed_pendulum_system {
+public:
+    //! Copies the parameters and the attractor_count attractors of the_system, which must have exactly that many attractors.
+    explicit fixed_pendulum_system(const pendulum_system &the_system);
+
+    //! Function call that returns the derivative of the current state, see pendulum_system::operator().
+    void operator()(const state_type &x, state_type &dxdt, const double t) const;
+
+    //! Function call that returns the derivative for a batch of states, see pendulum_system::operator().
+    template <std::size_t lanes>
+    void operator()(const batch_state_type<lanes> &x, batch_state_type<lanes> &dxdt, const std::array<double, lanes> &t) const;
+
+    const real d; /*!< Distance between the pendulum head at rest and the base plate. */
+    const real m; /*!< Mass of the head of the pendulum. */
+    const real g; /*!< Acceleration due to gravity. */
+    const real b; /*!< Linear drag coefficient. */
+    const real L; /*!< Length of the pendulum. */
+private:
+    std::array<real, attractor_count> m_attractor_x;
+    std::array<real, attractor_count> m_attractor_y;
+    std::array<real, attractor_count> m_attractor_k;
+
+    // float computes d+L-sqrt(L^2-r^2) as d+r^2/(L+sqrt(L^2-r^2)), which avoids the cancellation near rest, double keeps the form of pendulum_system
+    static constexpr bool use_rest_height_form = std::is_same<real, float>::value;
+};
+
+/*!
+ * \brief Calls function with the fixed_pendulum_system matching the attractor count of the_system, or with the_system itself when it has
+ * no attractors or more than max_fixed_attractor_count of them.
+ *
+ * \details function is called once with a const reference to the system, so it must accept any of the system types, e.g. a generic lambda
+ * or a function object with a templated call operator. The dispatch happens once per call, do it around a whole loop of integrations and not
+ * per step. Every attractor count instantiates function, keep it to the integration loop. real is the precision of the fixed systems, the
+ * fallback to the_system is always double.
+ */
+template <typename real = double, typename function>
+void dispatch_attractor_count(const pendulum_system &the_system, function &&f);
+
+template <std::size_t attractor_count, typename real>
+fixed_pendulum_system<attractor_count, real>::fixed_pendulum_system(const pendulum_system &the_system)
+    : d(the_system.d), m(the_system.m), g(the_system.g), b(the_system.b), L(the_system.L)
+{
+    for (std::size_t n = 0; n < attractor_count; n++) {
+        m_attractor_x[n] = the_system.attractor_list()[n].x;
+        m_attractor_y[n] = the_system.attractor_list()[n].y;
+        m_attractor_k[n] = the_system.attractor_list()[n].k;
+    }
+}
+
+template <std::size_t attractor_count, typename real>
+inline void fixed_pendulum_system<attractor_count, real>::operator() (const state_type &x, state_type &dxdt, const double /* t */) const
+{
+    const real x_position = x[0];
+    const real y_position = x[1];
+    const real x_squared = x_position*x_position;
+    const real y_squared = y_position*y_position;
+    const real L_squared = L*L;
+    const real norm_squared = x_squared + y_squared;
+
+    const real g_value = -m*g/L * std::sqrt(real(1.0) - norm_squared/L_squared);
+
+    real f_m_x = 0.0;
+    real f_m_y = 0.0;
+
+    const real plate_root = std::sqrt(L_squared-norm_squared);
+    const real a_value = use_rest_height_form ? d + norm_squared/(L+plate_root) : (d+L-plate_root);
+    const real a_value_squared = a_value*a_value;
+
+    for (std::size_t n = 0; n < attractor_count; n++) {
+        const real ax_value = x_position-m_attractor_x[n];
+        const real ay_value = y_position-m_attractor_y[n];
+        const real distance_squared = ax_value*ax_value+ay_value*ay_value+a_value_squared;
+        const real a_denom = -m_attractor_k[n]/(distance_squared*std::sqrt(distance_squared));
+        f_m_x += ax_value*a_denom;
+        f_m_y += ay_value*a_denom;
+    }
+
+    dxdt[0] = x[2];
+    dxdt[1] = x[3];
+    dxdt[2] = (x_position*g_value - b*real(x[2]) + f_m_x) / m;
+    dxdt[3] = (y_position*g_value - b*real(x[3]) + f_m_y) / m;
+}
+
+template <std::size_t attractor_count, typename real>
+template <std::size_t lanes>
+inline void fixed_pendulum_system<attractor_count, real>::operator() (const batch_state_type<lanes> &x, batch_state_type<lanes> &dxdt, const std::array<double, lanes> & /* t */) const
+{
+    const real L_squared = L*L;
+
+    std::array<real, lanes> x_position;
+    std::array<real, lanes> y_position;
+    std::array<real, lanes> g_value;
+    std::array<real, lanes> a_value_squared;
+    std::array<real, lanes> f_m_x;
+    std::array<real, lanes> f_m_y;
+    for (std::size_t l = 0; l < lanes; l++) {
+        x_position[l] = x[0][l];
+        y_position[l] = x[1][l];
+        const real norm_squared = x_position[l]*x_position[l] + y_position[l]*y_position[l];
+        g_value[l] = -m*g/L * std::sqrt(real(1.0) - norm_squared/L_squared);
+        const real plate_root = std::sqrt(L_squared-norm_squared);
+        const real a_value = use_rest_height_form ? d + norm_squared/(L+plate_root) : (d+L-plate_root);
+        a_value_squared[l] = a_value*a_value;
+        f_m_x[l] = 0.0;
+        f_m_y[l] = 0.0;
+    }
+
+    // attractors in the outer loop so the inner loop runs across lanes with no dependencies
+    for (std::size_t n = 0; n < attractor_count; n++) {
+        for (std::size_t l = 0; l < lanes; l++) {
+            const real ax_value = x_position[l]-m_attractor_x[n];
+            const real ay_value = y_position[l]-m_attractor_y[n];
+            const real distance_squared = ax_value*ax_value+ay_value*ay_value+a_value_squared[l];
+            const real a_denom = -m_attractor_k[n]/(distance_squared*std::sqrt(distance_squared));
+            f_m_x[l] += ax_value*a_denom;
+            f_m_y[l] += ay_value*a_denom;
+        }
+    }
+
+    for (std::size_t l = 0; l < lanes; l++) {
+        dxdt[0][l] = x[2][l];
+        dxdt[1][l] = x[3][l];
+        dxdt[2][l] = (x_position[l]*g_value[l] - b*real(x[2][l]) + f_m_x[l]) / m;
+        dxdt[3][l] = (y_position[l]*g_value[l] - b*real(x[3][l]) + f_m_y[l]) / m;
+    }
+}
+
+// tries the attractor counts from attractor_count up to max_fixed_attractor_count, the last one falls back to the dynamic system
+template <std::size_t attractor_count, typename real>
+struct attractor_count_dispatcher {
+    template <typename function>
+    static void call(const pendulum_system &the_system, function &f)
+    {
+        if (the_system.attractor_list().size() == attractor_count) {
+            const fixed_pendulum_system<attractor_count, real> fixed_system(the_system);
+            f(fixed_system);
+        } else {
+            attractor_count_dispatcher<attractor_count + 1, real>::call(the_system, f);
+        }
+    }
+};
+
+template <typename real>
+struct attractor_count_dispatcher<max_fixed_attractor_count + 1, real> {
+    template <typename function>
+    static void call(const pendulum_system &the_system, function &f)
+    {
+        f(the_system);
+    }
+};
+
+template <typename real, typename function>
+void dispatch_attractor_count(const pendulum_system &the_system, function &&f)
+{
+    attractor_count_dispatcher<1, real>::call(the_system, f);
+}
+
+
 #endif // PENDULUM_SYSTEM_H
@@ -0,0 +1,623 @@
+#ifndef RENDER_DAEMON_H
+#define RENDER_DAEMON_H
+#include "pendulum_map.h"
+#include "pendulum_system.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+#include "tile_cache.h"
+#include "map_file.h"
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <new>
+#include <iostream>
+#include <QImage>
+#include <QBuffer>
+#include <QByteArray>
+#include <QString>
+#ifdef __unix__
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/*!
+ * \brief Render request of a render_daemon client.
+ *
+ * \details A request is one line of space separated key=value fields, the fields that are left out keep the defaults below: id,
+ * viewport, integrator (the name() of one of the daemon integrators, the first one if empty), relative_tolerance and absolute_tolerance
+ * (integrators with a set_tolerance only), x_start, x_end, y_start, y_end and resolution (see pendulum_map::set_map), the pendulum_system
+ * parameters d, m, g, b and L, attractor=x,y,k once per attractor (replacing the default attractors, k defaults to 1), format (raw or png)
+ * and image (position or time, for png). The line quit stops the daemon. Numbers, attractor coordinates included, must be finite, a request
+ * may list at most max_fixed_attractor_count attractors and a map may have at most render_request_max_points points and coordinates up
+ * to render_request_max_coordinate, so one request can not take the memory or the workers of the daemon.
+ */
+struct render_request
+{
+    std::string id; // echoed in the response
+    std::string viewport; // a newer request for the same viewport cancels this one
+    std::string integrator; // empty for the first integrator of the daemon
+    double relative_tolerance = 0.0; // 0 keeps the tolerance of the daemon integrator
+    double absolute_tolerance = 0.0;
+    double x_start = -10.0;
+    double x_end = 10.0;
+    double y_start = -10.0;
+    double y_end = 10.0;
+    double resolution = 0.05;
+    pendulum_system system;
+    std::string format = "raw";
+    std::string image = "position";
+    bool quit = false;
+};
+
+//! Most points of a requested map, 4096 by 4096, a raw response holds 8 bytes per point.
+const double render_request_max_points = 4096.0*4096.0;
+
+//! Largest absolute coordinate of a requested map range.
+const double render_request_max_coordinate = 1.0e6;
+
+//! Longest request line a render_daemon reads, a connection sending a longer line is closed.
+const std::size_t render_request_max_line = 65536;
+
+//! Seconds a render_daemon waits for a client to take a response before it closes the connection.
+const int render_daemon_send_timeout = 10;
+
+//! Parse a request line into request, returns false and sets error if a field is unknown or its value is invalid.
+inline bool parse_render_request(const std::string &line, render_request &request, std::string &error);
+
+/*!
+ * \brief Serves render requests over a local Unix socket with the thread pool, map settings and tile cache kept warm between requests.
+ *
+ * \details A process per render pays for creating the threads, the Qt objects and the output files on every request. The daemon is
+ * started once and renders each request (see render_request) on the workers of one thread pool, with the map settings of mapper() for
+ * the requested integrator and a tile cache that is shared by all requests, so pans and zooms over the same grid reuse earlier points.
+ * A client sends request lines and reads one response per request, in request order. A response is a line of space separated
+ * key=value fields, id, status (ok, cancelled or error) and bytes, then for ok xdim, ydim, points, avg_number_of_steps,
+ * max_integration_time and computation_time or for error message= and the rest of the line, followed by bytes bytes of payload.
+ * The payload of a raw request is a map_file_point record per point, row by row starting at the lowest y, of a png request the PNG file
+ * of the position or time image as pendulum_map saves it.
+ *
+ * Requests are read by a thread per connection and rendered one at a time in arrival order, a render uses every worker of the pool.
+ * A render that runs out of memory is answered with an error. A connection that sends more than render_request_max_line bytes without
+ * ending the line is closed, and so is one that does not read a response within render_daemon_send_timeout seconds, so a client that
+ * stops reading can not stall the renderer.
+ * A request with the same viewport as a queued or rendering request cancels the older one: a queued request is answered as cancelled
+ * without rendering and a rendering request stops starting tiles, so the newer request waits for at most one tile per worker.
+ * Unix only, run returns false elsewhere.
+ */
+template <typename... integrator_types>
+class render_daemon
+{
+public:
+    //! Create a daemon that renders on the workers of pool and with cache (owned by the caller, nullptr for none) for every request.
+    explicit render_daemon(thread_pool &pool, tile_cache *cache = nullptr);
+
+    render_daemon(const render_daemon &) = delete;
+    render_daemon &operator=(const render_daemon &) = delete;
+
+    //! Map settings the requests for integrator_type start from, such as the tolerances, tile size, batch mode and colors. The map ranges and resolution are set by each request.
+    template <typename integrator_type>
+    pendulum_map<integrator_type> &mapper() { return std::get<pendulum_map<integrator_type>>(m_mappers); }
+
+    //! Integrator the requests for integrator_type start from before their tolerances are applied.
+    template <typename integrator_type>
+    integrator_type &integrator() { return std::get<integrator_type>(m_integrators); }
+
+    //! Listen on the Unix socket socket_path (replacing an existing file) and serve requests until a quit request, returns false if the socket can not be created.
+    bool run(const QString &socket_path);
+private:
+    // a client connection, shared by its reader thread and the responses to its requests
+    struct connection
+    {
+        int socket = -1;
+        std::mutex write_mutex; // one response at a time
+        std::atomic<bool> closed{false}; // the reader thread has finished
+        ~connection();
+    };
+
+    struct render_job
+    {
+        render_request request;
+        std::string error; // parse error, answered in order with the other requests of the connection
+        std::shared_ptr<connection> client;
+        std::atomic<bool> cancelled{false};
+    };
+
+    struct connection_thread
+    {
+        std::shared_ptr<connection> client;
+        std::thread reader;
+    };
+
+    thread_pool &m_pool;
+    std::tuple<pendulum_map<integrator_types>...> m_mappers;
+    std::tuple<integrator_types...> m_integrators;
+    int m_listen_socket = -1;
+    std::vector<connection_thread> m_connections; // used by the accepting thread until it is joined
+    std::mutex m_mutex; // guards the queue, viewports and stop flag
+    std::condition_variable m_queued;
+    std::deque<std::shared_ptr<render_job>> m_jobs;
+    std::map<std::string, std::shared_ptr<render_job>> m_viewports; // newest job of every viewport
+    bool m_stop = false;
+
+    // share pool and cache with the mapper of integrator_type, returns 0 for the pack expansion
+    template <typename integrator_type>
+    int init_mapper(tile_cache *cache);
+
+    // accept connections and start their reader threads until the listening socket is shut down
+    void accept_connections();
+
+    // read request lines from client and queue them until the connection closes
+    void serve_connection(std::shared_ptr<connection> client);
+
+    // parse line and queue it, cancelling the older job of its viewport
+    void queue_request(const std::string &line, const std::shared_ptr<connection> &client);
+
+    // render the queued jobs in order until the daemon stops
+    void render_jobs();
+
+    // render job with the integrator it names, or answer it as cancelled or invalid
+    void render(render_job &job);
+
+    // render job with integrator_type, returns false if the job names another integrator
+    template <typename integrator_type>
+    bool render_with(render_job &job);
+
+    // apply the tolerances of request to integrators that have adjustable tolerances
+    template <typename integrator_type>
+    static auto set_request_tolerance(integrator_type &the_integrator, const render_request &request, int)
+        -> decltype(the_integrator.set_tolerance(0.0, 0.0), void());
+    template <typename integrator_type>
+    static void set_request_tolerance(integrator_type &, const render_request &, long) {}
+
+    // write the response line of job with status and fields (after id, status and bytes) and payload to client
+    static void respond(connection &client, const render_job &job, const std::string &status, const std::string &fields, const QByteArray &payload = QByteArray());
+};
+
+inline bool parse_render_request(const std::string &line, render_request &request, std::string &error)
+{
+    std::istringstream fields(line);
+    std::string field;
+    bool default_attractors = true;
+    while (fields >> field) {
+        if (field == "quit") {
+            request.quit = true;
+            continue;
+        }
+        const std::size_t separator = field.find('=');
+        if (separator == std::string::npos) {
+            error = "field " + field + " has no value";
+            return false;
+        }
+        const std::string key = field.substr(0, separator);
+        const std::string value = field.substr(separator + 1);
+        // nan and inf are rejected by their spelling, the release build compiles std::isfinite away with -ffast-math
+        auto number = [](const std::string &text, double &result) {
+            char *end = nullptr;
+            errno = 0;
+            result = std::strtod(text.c_str(), &end);
+            return !text.empty() && *end == '\0' && errno != ERANGE && text.find_first_of("iInN") == std::string::npos;
+        };
+
+        bool valid = true;
+        if (key == "id") {
+            request.id = value;
+        } else if (key == "viewport") {
+            request.viewport = value;
+        } else if (key == "integrator") {
+            request.integrator = value;
+        } else if (key == "format") {
+            request.format = value;
+            valid = (value == "raw" || value == "png");
+        } else if (key == "image") {
+            request.image = value;
+            valid = (value == "position" || value == "time");
+        } else if (key == "attractor") {
+            // x,y or x,y,k, every part a number
+            double coordinates[3] = {0.0, 0.0, 1.0};
+            std::size_t part_count = 0;
+            std::size_t part_begin = 0;
+            for (std::size_t part_end = 0; valid && part_end != std::string::npos; part_begin = part_end + 1) {
+                part_end = value.find(',', part_begin);
+                valid = part_count < 3 && number(value.substr(part_begin, part_end == std::string::npos ? std::string::npos : part_end - part_begin), coordinates[part_count]);
+                part_count++;
+            }
+            valid = valid && part_count >= 2;
+            if (valid) {
+                if (default_attractors) {
+                    request.system.clear_attractors();
+                    default_attractors = false;
+                }
+                if (request.system.attractor_list().size() >= max_fixed_attractor_count) {
+                    error = "more than " + std::to_string(max_fixed_attractor_count) + " attractors";
+                    return false;
+                }
+                request.system.add_attractor(coordinates[0], coordinates[1], coordinates[2]);
+            }
+        } else {
+            double *target = key == "relative_tolerance" ? &request.relative_tolerance : key == "absolute_tolerance" ? &request.absolute_tolerance
+                    : key == "x_start" ? &request.x_start : key == "x_end" ? &request.x_end : key == "y_start" ? &request.y_start
+                    : key == "y_end" ? &request.y_end : key == "resolution" ? &request.resolution : key == "d" ? &request.system.d
+                    : key == "m" ? &request.system.m : key == "g" ? &request.system.g : key == "b" ? &request.system.b
+                    : key == "L" ? &request.system.L : nullptr;
+            if (target == nullptr) {
+                error = "unknown field " + key;
+                return false;
+            }
+            valid = number(value, *target);
+        }
+        if (!valid) {
+            error = "invalid value " + value + " of field " + key;
+            return false;
+        }
+    }
+    if (request.quit) {
+        return true;
+    }
+    if (request.resolution <= 0.0 || request.x_end < request.x_start || request.y_end < request.y_start) {
+        error = "empty map or resolution not positive";
+        return false;
+    }
+    const double coordinate = std::max(std::max(std::abs(request.x_start), std::abs(request.x_end)), std::max(std::abs(request.y_start), std::abs(request.y_end)));
+    if (coordinate > render_request_max_coordinate) {
+        std::ostringstream message;
+        message << "map range beyond " << render_request_max_coordinate;
+        error = message.str();
+        return false;
+    }
+    // as pendulum_map::map_dimensions counts them, the grid factors of the range have to fit an int as well
+    const double xdim = std::round((request.x_end - request.x_start)/request.resolution) + 1.0;
+    const double ydim = std::round((request.y_end - request.y_start)/request.resolution) + 1.0;
+    if (xdim*ydim > render_request_max_points || coordinate/request.resolution > 1073741824.0) {
+        error = "map of more than " + std::to_string(std::uint64_t(render_request_max_points)) + " points or resolution too fine for its range";
+        return false;
+    }
+    return true;
+}
+
+template <typename... integrator_types>
+render_daemon<integrator_types...>::render_daemon(thread_pool &pool, tile_cache *cache) : m_pool(pool)
+{
+    const int expand[] = {0, init_mapper<integrator_types>(cache)...};
+    (void)expand;
+}
+
+template <typename... integrator_types>
+template <typename integrator_type>
+int render_daemon<integrator_types...>::init_mapper(tile_cache *cache)
+{
+    mapper<integrator_type>().set_thread_pool(&m_pool);
+    mapper<integrator_type>().set_tile_cache(cache);
+    return 0;
+}
+
+template <typename... integrator_types>
+render_daemon<integrator_types...>::connection::~connection()
+{
+#ifdef __unix__
+    ::close(socket);
+#endif
+}
+
+template <typename... integrator_types>
+bool render_daemon<integrator_types...>::run(const QString &socket_path)
+{
+#ifdef __unix__
+    const std::string path = socket_path.toStdString();
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cout << "Render daemon socket path " << path << " is too long\n";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    ::unlink(path.c_str());
+    m_listen_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_socket < 0 || ::bind(m_listen_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || ::listen(m_listen_socket, 16) != 0) {
+        std::cout << "Could not listen on render daemon socket " << path << '\n';
+        if (m_listen_socket >= 0) {
+            ::close(m_listen_socket);
+        }
+        return false;
+    }
+    m_stop = false;
+    std::cout << "Render daemon listening on " << path << '\n';
+
+    std::thread acceptor(&render_daemon::accept_connections, this);
+    render_jobs();
+
+    // shutting the sockets down wakes the accepting and reading threads
+    ::shutdown(m_listen_socket, SHUT_RDWR);
+    acceptor.join();
+    ::close(m_listen_socket);
+    for (auto &the_connection : m_connections) {
+        ::shutdown(the_connection.client->socket, SHUT_RDWR);
+    }
+    for (auto &the_connection : m_connections) {
+        the_connection.reader.join();
+    }
+    m_connections.clear();
+    m_jobs.clear();
+    m_viewports.clear();
+    ::unlink(path.c_str());
+    return true;
+#else
+    (void)socket_path;
+    std::cout << "The render daemon needs Unix domain sockets\n";
+    return false;
+#endif
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::accept_connections()
+{
+#ifdef __unix__
+    for (;;) {
+        const int client_socket = ::accept(m_listen_socket, nullptr, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                if (client_socket >= 0) {
+                    ::close(client_socket);
+                }
+                return;
+            }
+        }
+        if (client_socket < 0) {
+            continue;
+        }
+        // threads of closed connections are joined as new ones arrive
+        for (auto it = m_connections.begin(); it != m_connections.end();) {
+            if (it->client->closed) {
+                it->reader.join();
+                it = m_connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        connection_thread the_connection;
+        the_connection.client = std::make_shared<connection>();
+        the_connection.client->socket = client_socket;
+        // responses are sent by the render thread, a send to a client that stops reading gives up instead of blocking it
+        timeval send_timeout;
+        send_timeout.tv_sec = render_daemon_send_timeout;
+        send_timeout.tv_usec = 0;
+        ::setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        the_connection.reader = std::thread(&render_daemon::serve_connection, this, the_connection.client);
+        m_connections.push_back(std::move(the_connection));
+    }
+#endif
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::serve_connection(std::shared_ptr<connection> client)
+{
+#ifdef __unix__
+    std::string pending;
+    char buffer[4096];
+    for (;;) {
+        const ssize_t received = ::recv(client->socket, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            break;
+        }
+        pending.append(buffer, received);
+        for (std::size_t newline = pending.find('\n'); newline != std::string::npos; newline = pending.find('\n')) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                queue_request(line, client);
+            }
+        }
+        if (pending.size() > render_request_max_line) {
+            std::cout << "Render daemon closed a connection sending a request line longer than " << render_request_max_line << " bytes\n";
+            ::shutdown(client->socket, SHUT_RDWR);
+            break;
+        }
+    }
+#endif
+    client->closed = true;
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::queue_request(const std::string &line, const std::shared_ptr<connection> &client)
+{
+    std::shared_ptr<render_job> job = std::make_shared<render_job>();
+    job->client = client;
+    const bool valid = parse_render_request(line, job->request, job->error);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stop) {
+        return;
+    }
+    if (valid && job->request.quit) {
+        m_stop = true;
+        m_queued.notify_all();
+        return;
+    }
+    if (valid && !job->request.viewport.empty()) {
+        std::shared_ptr<render_job> &newest = m_viewports[job->request.viewport];
+        if (newest) {
+            newest->cancelled = true;
+        }
+        newest = job;
+    }
+    m_jobs.push_back(job);
+    m_queued.notify_all();
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::render_jobs()
+{
+    for (;;) {
+        std::shared_ptr<render_job> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queued.wait(lock, [this]() {return m_stop || !m_jobs.empty();});
+            if (m_stop) {
+                return;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        render(*job);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto newest = m_viewports.find(job->request.viewport);
+        if (newest != m_viewports.end() && newest->second == job) {
+            m_viewports.erase(newest);
+        }
+    }
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::render(render_job &job)
+{
+    // nobody reads the answers of a connection that is closed, such as one shut down after a send timed out
+    if (job.client->closed) {
+        return;
+    }
+    if (!job.error.empty()) {
+        respond(*job.client, job, "error", "message=" + job.error);
+        return;
+    }
+    if (job.cancelled) {
+        respond(*job.client, job, "cancelled", "");
+        return;
+    }
+    // the first integrator the job names renders it
+    bool rendered = false;
+    try {
+        const int expand[] = {0, (rendered = rendered || render_with<integrator_types>(job), 0)...};
+        (void)expand;
+    } catch (const std::bad_alloc &) {
+        // the map, the image or the payload did not fit in memory, the daemon keeps serving smaller requests
+        respond(*job.client, job, "error", "message=out of memory");
+        return;
+    }
+    if (!rendered) {
+        respond(*job.client, job, "error", "message=unknown integrator " + job.request.integrator);
+    }
+}
+
+template <typename... integrator_types>
+template <typename integrator_type>
+bool render_daemon<integrator_types...>::render_with(render_job &job)
+{
+    const render_request &request = job.request;
+    if (!request.integrator.empty() && request.integrator != integrator_type::name()) {
+        return false;
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pendulum_map<integrator_type> the_mapper(mapper<integrator_type>());
+    integrator_type the_integrator(integrator<integrator_type>());
+    set_request_tolerance(the_integrator, request, 0);
+    the_mapper.set_map(request.x_start, request.x_end, request.y_start, request.y_end, request.resolution);
+
+    map_type the_map = the_mapper.create_map_container();
+    map_statistics statistics;
+    std::mutex statistics_mutex;
+    tile_scheduler scheduler(the_map.xdim(), the_map.ydim(), the_mapper.tile_width(), the_mapper.tile_height());
+    scheduler.run(m_pool, [&](const map_tile &tile, unsigned int) {
+        // a cancelled job starts no more tiles, the tiles in progress finish
+        if (job.cancelled) {
+            return;
+        }
+        map_statistics tile_statistics;
+        the_mapper.integrate_map_tile(the_integrator, request.system, the_map, tile, tile_statistics);
+        std::lock_guard<std::mutex> lock(statistics_mutex);
+        statistics.merge(tile_statistics);
+    });
+    if (job.cancelled) {
+        respond(*job.client, job, "cancelled", "");
+        return true;
+    }
+
+    QByteArray payload;
+    if (request.format == "png") {
+        const QImage image = request.image == "time" ? the_mapper.time_image(the_map, statistics.max_time) : the_mapper.position_image(the_map);
+        QBuffer buffer(&payload);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "PNG");
+    } else {
+        payload.resize(the_map.size()*sizeof(map_file_point));
+        map_file_point *records = reinterpret_cast<map_file_point *>(payload.data());
+        for (std::size_t k = 0; k < the_map.size(); k++) {
+            records[k] = map_file_point::from_point(the_map[k]);
+        }
+    }
+    const std::chrono::duration<double> elapsed_seconds = std::chrono::steady_clock::now() - start;
+
+    std::ostringstream fields;
+    fields << "xdim=" << the_map.xdim() << " ydim=" << the_map.ydim() << " points=" << statistics.total_count
+           << " avg_number_of_steps=" << statistics.avg_step_count() << " max_integration_time=" << statistics.max_time
+           << " computation_time=" << elapsed_seconds.count();
+    respond(*job.client, job, "ok", fields.str(), payload);
+    return true;
+}
+
+template <typename... integrator_types>
+template <typename integrator_type>
+auto render_daemon<integrator_types...>::set_request_tolerance(integrator_type &the_integrator, const render_request &request, int)
+    -> decltype(the_integrator.set_tolerance(0.0, 0.0), void())
+{
+    if (request.relative_tolerance > 0.0 || request.absolute_tolerance > 0.0) {
+        the_integrator.set_tolerance(request.relative_tolerance > 0.0 ? request.relative_tolerance : the_integrator.relative_tolerance(),
+                                     request.absolute_tolerance > 0.0 ? request.absolute_tolerance : the_integrator.absolute_tolerance());
+    }
+}
+
+template <typename... integrator_types>
+void render_daemon<integrator_types...>::respond(connection &client, const render_job &job, const std::string &status, const std::string &fields, const QByteArray &payload)
+{
+#ifdef __unix__
+    // the message of an error takes the rest of the line, so the fields come after bytes
+    std::string response = "id=" + job.request.id + " status=" + status + " bytes=" + std::to_string(payload.size());
+    if (!fields.empty()) {
+        response += " " + fields;
+    }
+    response += '\n';
+    response.append(payload.data(), payload.size());
+
+    std::lock_guard<std::mutex> lock(client.write_mutex);
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        const ssize_t count = ::send(client.socket, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            // timed out or closed, the rest of the response can not be sent so the connection is closed
+            ::shutdown(client.socket, SHUT_RDWR);
+            return;
+        }
+        sent += count;
+    }
+#else
+    (void)client;
+    (void)job;
+    (void)status;
+    (void)fields;
+    (void)payload;
+#endif
+}
+
+#endif // RENDER_DAEMON_H
@@ -0,0 +1,150 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*!
+ * \brief Persistent set of worker threads reused by every map integration.
+ *
+ * \details Creating and joining threads for each map costs time on every frame of a sweep and, with a fixed thread count,
+ * oversubscribes smaller machines. The pool starts its workers once, by default one per hardware thread, and runs jobs on all
+ * of them until it is destroyed. Workers can optionally be pinned, worker i to CPU i (Linux only, ignored elsewhere), which keeps
+ * them on one socket and lets memory they touch first stay local to it (see map_grid::initialize_rows).
+ * The pool is owned outside pendulum_map and shared through pendulum_map::set_thread_pool. Jobs must not start another run on the
+ * same pool, the nested run would wait on the workers that are running it.
+ */
+class thread_pool
+{
+public:
+    //! Start nthreads workers, 0 for std::thread::hardware_concurrency(), and pin worker i to CPU i if pin_threads is set.
+    explicit thread_pool(unsigned int nthreads = 0, bool pin_threads = false);
+
+    //! Stop and join the workers.
+    ~thread_pool();
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    //! Number of worker threads.
+    unsigned int size() const { return m_workers.size(); }
+
+    //! Whether the workers are pinned to CPUs.
+    bool pinned() const { return m_pinned; }
+
+    //! Call job(worker_index) once on every worker and wait until all calls returned. Runs from different threads are serialized.
+    void run(const std::function<void(unsigned int)> &job);
+
+    //! True when called from one of the workers of this pool, where run must not be called.
+    bool is_worker_thread() const;
+private:
+    std::vector<std::thread> m_workers;
+    bool m_pinned = false;
+    std::mutex m_run_mutex; // one run at a time
+    std::mutex m_mutex; // guards the job state below
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    const std::function<void(unsigned int)> *m_job = nullptr;
+    unsigned long long m_generation = 0; // incremented for every run, workers run the job once per generation
+    unsigned int m_pending = 0; // workers still running the current job
+    bool m_stop = false;
+
+    // worker loop, waits for a new generation and runs the job with its index
+    void worker(unsigned int worker_index);
+
+    // pool the calling thread works for, nullptr outside of pool workers
+    static const thread_pool *&current_pool();
+};
+
+inline thread_pool::thread_pool(unsigned int nthreads, bool pin_threads)
+{
+    const unsigned int hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (nthreads == 0) {
+        nthreads = hardware_threads;
+    }
+#ifdef __linux__
+    m_pinned = pin_threads;
+#else
+    (void)pin_threads;
+#endif
+    m_workers.reserve(nthreads);
+    for (unsigned int i = 0; i < nthreads; i++) {
+        m_workers.push_back(std::thread(&thread_pool::worker, this, i));
+#ifdef __linux__
+        if (pin_threads) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % hardware_threads, &cpu_set);
+            if (pthread_setaffinity_np(m_workers.back().native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+                m_pinned = false;
+            }
+        }
+#endif
+    }
+}
+
+inline thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start.notify_all();
+    std::for_each(m_workers.begin(), m_workers.end(), [](std::thread& x){x.join();});
+}
+
+inline void thread_pool::run(const std::function<void(unsigned int)> &job)
+{
+    std::lock_guard<std::mutex> run_lock(m_run_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job = &job;
+    m_pending = m_workers.size();
+    m_generation++;
+    m_start.notify_all();
+    m_done.wait(lock, [this]() {return m_pending == 0;});
+    m_job = nullptr;
+}
+
+inline bool thread_pool::is_worker_thread() const
+{
+    return current_pool() == this;
+}
+
+inline const thread_pool *&thread_pool::current_pool()
+{
+    static thread_local const thread_pool *pool = nullptr;
+    return pool;
+}
+
+inline void thread_pool::worker(unsigned int worker_index)
+{
+    current_pool() = this;
+    unsigned long long generation = 0;
+    while (true) {
+        const std::function<void(unsigned int)> *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&]() {return m_stop || m_generation != generation;});
+            if (m_stop) {
+                return;
+            }
+            generation = m_generation;
+            job = m_job;
+        }
+        (*job)(worker_index);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending--;
+        }
+        m_done.notify_one();
+    }
+}
+
+#endif // THREAD_POOL_H
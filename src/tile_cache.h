@@ -0,0 +1,264 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+#include <vector>
+#include <string>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <QFile>
+#include <QSaveFile>
+#include <QDir>
+#include <QString>
+#include "map_grid.h"
+#include "map_file.h"
+#include "tile_scheduler.h"
+#include "pendulum_system.h"
+
+/*!
+ * \brief On-disk cache of integrated points shared by every map of the same system and settings, so overlapping or recolored re-renders reuse earlier results.
+ *
+ * \details Points are grouped in cache tiles of tile_size by tile_size points aligned to the global grid, the point with global index
+ * (gx, gy) is the point at (gx*resolution, gy*resolution) as in map_grid::start_state, so maps that pan or zoom out over the same grid
+ * share tiles whatever their x and y ranges. The cache key holds everything the results depend on: a map_file_header with the system
+ * parameters, the integrator and its tolerances, the convergence settings, batch mode and its instruction set path and the resolution
+ * (grid fields zeroed), the attractors and the global tile coordinates. Each cache tile is stored in a file named after the 64 bit
+ * FNV-1a hash of its key, so the cache is content addressed: the file of a tile is found without an index and any change of the settings
+ * reads different files. The file repeats the key to rule out hash collisions and stores a map_file_point record and a valid flag
+ * per point, so tiles that were only partly inside earlier maps are completed by later ones. Files are replaced atomically with
+ * QSaveFile, concurrent renders of the same region at worst lose a store but never read a torn file.
+ */
+class tile_cache
+{
+public:
+    //! Keep the cache files in directory (created if needed), cache tiles are tile_size by tile_size points.
+    explicit tile_cache(const QString &directory, unsigned int tile_size = 64);
+
+    tile_cache(const tile_cache &) = delete;
+    tile_cache &operator=(const tile_cache &) = delete;
+
+    unsigned int tile_size() const { return m_tile_size; }
+
+    //! Key for the maps described by header and the attractors of the_system, the grid fields of header are ignored.
+    static std::string make_key(map_file_header header, const pendulum_system &the_system);
+
+    //! Store the cached points of tile of the_map into the_map and add them to statistics, restored[k] is set for each restored point (tile row by row). Returns the number of restored points.
+    unsigned int load(const std::string &key, map_grid &the_map, const map_tile &tile, std::vector<char> &restored, map_statistics &statistics) const;
+
+    //! Add the points of tile of the_map to the cache.
+    void store(const std::string &key, const map_grid &the_map, const map_tile &tile);
+
+    //! 64 bit FNV-1a hash of bytes, names the cache tile files.
+    static std::uint64_t fnv1a(const std::string &bytes);
+
+    //! Number of cache tile files read and written since the cache was created.
+    unsigned long long read_count() const { return m_read_count; }
+    unsigned long long write_count() const { return m_write_count; }
+private:
+    // valid flags and records of the points of a cache tile as stored after the key in its file
+    struct cache_tile
+    {
+        std::vector<unsigned char> valid;
+        std::vector<map_file_point> points;
+    };
+
+    QString m_directory;
+    unsigned int m_tile_size;
+    std::array<std::mutex, 64> m_store_mutexes; // stores of the same cache tile are serialized within the process
+    mutable std::atomic<unsigned long long> m_read_count;
+    std::atomic<unsigned long long> m_write_count;
+
+    // full key of a cache tile and the name of its file
+    std::string tile_key(const std::string &key, std::int64_t tile_x, std::int64_t tile_y) const;
+    QString tile_filename(const std::string &full_key) const;
+
+    // read the cache tile with full_key, returns false if it is not cached
+    bool read_tile(const std::string &full_key, cache_tile &the_tile) const;
+
+    // cache tiles overlapping tile of the_map as global tile coordinates [first, last] in x and y
+    void tile_range(const map_grid &the_map, const map_tile &tile, std::int64_t &first_x, std::int64_t &last_x, std::int64_t &first_y, std::int64_t &last_y) const;
+
+    // floor division for negative global indices
+    std::int64_t global_tile(std::int64_t global_index) const;
+
+};
+
+inline tile_cache::tile_cache(const QString &directory, unsigned int tile_size)
+    : m_directory(directory), m_tile_size(std::max(tile_size, 1u)), m_read_count(0), m_write_count(0)
+{
+    QDir().mkpath(directory);
+}
+
+inline std::string tile_cache::make_key(map_file_header header, const pendulum_system &the_system)
+{
+    // only the settings that change the results stay in the key. The flags all do: batch mode rounds differently from point by point
+    // integration once the compiler vectorizes and contracts the step, and so do the instruction set paths of the batch step
+    header.attractor_offset = 0;
+    header.tile_state_offset = 0;
+    header.data_offset = 0;
+    header.xdim = 0;
+    header.ydim = 0;
+    header.x_factor = 0;
+    header.y_factor = 0;
+    header.tiles_x = 0;
+    header.tiles_y = 0;
+    header.attractor_count = the_system.attractor_list().size();
+    header.complete = 0;
+    header.shard_index = 0; // a shard integrates the same points as the whole map
+    header.shard_count = 1;
+    header.computation_time = 0.0;
+    header.statistics = map_file_statistics();
+    if ((header.flags & map_file_boundary_tracing) == 0) {
+        header.tile_width = 0; // the map tiling only changes boundary traced results
+        header.tile_height = 0;
+    }
+    std::string key(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &the_attractor : the_system.attractor_list()) {
+        const map_file_attractor record{the_attractor.x, the_attractor.y, the_attractor.k};
+        key.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    return key;
+}
+
+inline std::string tile_cache::tile_key(const std::string &key, std::int64_t tile_x, std::int64_t tile_y) const
+{
+    const std::int64_t coordinates[3] = {tile_x, tile_y, std::int64_t(m_tile_size)};
+    return key + std::string(reinterpret_cast<const char *>(coordinates), sizeof(coordinates));
+}
+
+inline QString tile_cache::tile_filename(const std::string &full_key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.tile", static_cast<unsigned long long>(fnv1a(full_key)));
+    return m_directory + "/" + QString(name);
+}
+
+inline std::uint64_t tile_cache::fnv1a(const std::string &bytes)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const char byte : bytes) {
+        hash = (hash ^ static_cast<unsigned char>(byte))*1099511628211ull;
+    }
+    return hash;
+}
+
+inline std::int64_t tile_cache::global_tile(std::int64_t global_index) const
+{
+    const std::int64_t size = m_tile_size;
+    return global_index >= 0 ? global_index/size : -((-global_index + size - 1)/size);
+}
+
+inline void tile_cache::tile_range(const map_grid &the_map, const map_tile &tile, std::int64_t &first_x, std::int64_t &last_x, std::int64_t &first_y, std::int64_t &last_y) const
+{
+    first_x = global_tile(std::int64_t(the_map.x_factor()) + tile.x_begin);
+    last_x = global_tile(std::int64_t(the_map.x_factor()) + tile.x_end - 1);
+    first_y = global_tile(std::int64_t(the_map.y_factor()) + tile.y_begin);
+    last_y = global_tile(std::int64_t(the_map.y_factor()) + tile.y_end - 1);
+}
+
+inline bool tile_cache::read_tile(const std::string &full_key, cache_tile &the_tile) const
+{
+    const std::size_t point_count = std::size_t(m_tile_size)*m_tile_size;
+    QFile file(tile_filename(full_key));
+    if (!file.open(QIODevice::ReadOnly) || std::size_t(file.size()) != full_key.size() + point_count*(1 + sizeof(map_file_point))) {
+        return false;
+    }
+    std::string file_key(full_key.size(), '\0');
+    file.read(&file_key[0], file_key.size());
+    if (file_key != full_key) {
+        return false;
+    }
+    the_tile.valid.resize(point_count);
+    the_tile.points.resize(point_count);
+    file.read(reinterpret_cast<char *>(the_tile.valid.data()), point_count);
+    file.read(reinterpret_cast<char *>(the_tile.points.data()), point_count*sizeof(map_file_point));
+    m_read_count++;
+    return true;
+}
+
+inline unsigned int tile_cache::load(const std::string &key, map_grid &the_map, const map_tile &tile, std::vector<char> &restored, map_statistics &statistics) const
+{
+    const unsigned int tile_width = tile.x_end - tile.x_begin;
+    restored.assign(std::size_t(tile_width)*(tile.y_end - tile.y_begin), 0);
+    std::int64_t first_x, last_x, first_y, last_y;
+    tile_range(the_map, tile, first_x, last_x, first_y, last_y);
+    unsigned int restored_count = 0;
+    cache_tile the_tile;
+    for (std::int64_t tile_y = first_y; tile_y <= last_y; tile_y++) {
+        for (std::int64_t tile_x = first_x; tile_x <= last_x; tile_x++) {
+            if (!read_tile(tile_key(key, tile_x, tile_y), the_tile)) {
+                continue;
+            }
+            // overlap of the cache tile and the map tile in map indices
+            const std::int64_t x_origin = tile_x*m_tile_size - the_map.x_factor();
+            const std::int64_t y_origin = tile_y*m_tile_size - the_map.y_factor();
+            const unsigned int i_begin = std::max<std::int64_t>(tile.x_begin, x_origin);
+            const unsigned int i_end = std::min<std::int64_t>(tile.x_end, x_origin + m_tile_size);
+            const unsigned int j_begin = std::max<std::int64_t>(tile.y_begin, y_origin);
+            const unsigned int j_end = std::min<std::int64_t>(tile.y_end, y_origin + m_tile_size);
+            for (unsigned int j = j_begin; j < j_end; j++) {
+                for (unsigned int i = i_begin; i < i_end; i++) {
+                    const std::size_t cached = std::size_t(j - y_origin)*m_tile_size + (i - x_origin);
+                    if (!the_tile.valid[cached]) {
+                        continue;
+                    }
+                    const point_type the_point = the_tile.points[cached].point();
+                    the_map.set_point(the_map.index(i, j), the_point);
+                    statistics.add_point(the_point);
+                    restored[std::size_t(j - tile.y_begin)*tile_width + (i - tile.x_begin)] = 1;
+                    restored_count++;
+                }
+            }
+        }
+    }
+    statistics.reused_count += restored_count;
+    return restored_count;
+}
+
+inline void tile_cache::store(const std::string &key, const map_grid &the_map, const map_tile &tile)
+{
+    const std::size_t point_count = std::size_t(m_tile_size)*m_tile_size;
+    std::int64_t first_x, last_x, first_y, last_y;
+    tile_range(the_map, tile, first_x, last_x, first_y, last_y);
+    cache_tile the_tile;
+    for (std::int64_t tile_y = first_y; tile_y <= last_y; tile_y++) {
+        for (std::int64_t tile_x = first_x; tile_x <= last_x; tile_x++) {
+            const std::string full_key = tile_key(key, tile_x, tile_y);
+            std::lock_guard<std::mutex> lock(m_store_mutexes[fnv1a(full_key) % m_store_mutexes.size()]);
+            // merge with the points already cached for the tile
+            if (!read_tile(full_key, the_tile)) {
+                the_tile.valid.assign(point_count, 0);
+                the_tile.points.assign(point_count, map_file_point{0.0f, std::uint32_t(255) << 24});
+            }
+            const std::int64_t x_origin = tile_x*m_tile_size - the_map.x_factor();
+            const std::int64_t y_origin = tile_y*m_tile_size - the_map.y_factor();
+            const unsigned int i_begin = std::max<std::int64_t>(tile.x_begin, x_origin);
+            const unsigned int i_end = std::min<std::int64_t>(tile.x_end, x_origin + m_tile_size);
+            const unsigned int j_begin = std::max<std::int64_t>(tile.y_begin, y_origin);
+            const unsigned int j_end = std::min<std::int64_t>(tile.y_end, y_origin + m_tile_size);
+            for (unsigned int j = j_begin; j < j_end; j++) {
+                for (unsigned int i = i_begin; i < i_end; i++) {
+                    const std::size_t cached = std::size_t(j - y_origin)*m_tile_size + (i - x_origin);
+                    const point_type &the_point = the_map[the_map.index(i, j)];
+                    the_tile.valid[cached] = 1;
+                    the_tile.points[cached] = map_file_point::from_point(the_point);
+                }
+            }
+
+            QSaveFile file(tile_filename(full_key));
+            if (!file.open(QIODevice::WriteOnly)) {
+                continue;
+            }
+            file.write(full_key.data(), full_key.size());
+            file.write(reinterpret_cast<const char *>(the_tile.valid.data()), point_count);
+            file.write(reinterpret_cast<const char *>(the_tile.points.data()), point_count*sizeof(map_file_point));
+            if (file.commit()) {
+                m_write_count++;
+            }
+        }
+    }
+}
+
+#endif // TILE_CACHE_H
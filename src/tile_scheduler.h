@@ -0,0 +1,114 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "thread_pool.h"
+
+//! Rectangular block of map indices, covers x indices [x_begin, x_end) and y indices [y_begin, y_end).
+struct map_tile
+{
+    unsigned int x_begin;
+    unsigned int x_end;
+    unsigned int y_begin;
+    unsigned int y_end;
+    unsigned int map_index = 0; // map the tile belongs to when the tiles of several maps are scheduled together
+};
+
+//! Time a worker thread spent integrating tiles (busy) and waiting for the other threads to finish (idle) during one scheduler run.
+struct thread_timing
+{
+    double busy_time = 0.0;
+    double idle_time = 0.0;
+    unsigned int tile_count = 0;
+};
+
+/*!
+ * \brief Splits a map into tiles and hands them out to worker threads on demand.
+ *
+ * \details Convergence time varies by orders of magnitude across a map, so instead of giving each thread a fixed share of the map
+ * the tiles are dispensed one at a time through an atomic counter. A thread that finishes a cheap tile immediately takes the next one,
+ * which keeps all threads busy until the last tiles are handed out. The tiles are processed by the workers of a thread_pool.
+ */
+class tile_scheduler
+{
+public:
+    //! Split map_count xdim by ydim maps into tiles of tile_width by tile_height points, tiles on the upper edges are clipped to the map. Tiles are handed out map by map.
+    tile_scheduler(unsigned int xdim, unsigned int ydim, unsigned int tile_width, unsigned int tile_height, unsigned int map_count = 1);
+
+    //! Call tile_function(tile, thread_index) for every tile on the workers of pool and return the busy and idle time of each worker.
+    template <typename tile_function>
+    std::vector<thread_timing> run(thread_pool &pool, tile_function process_tile);
+
+    //! Same as run on a pool, but on nthreads threads that are started for this run only.
+    template <typename tile_function>
+    std::vector<thread_timing> run(unsigned int nthreads, tile_function process_tile);
+
+    //! The tiles in the order they are handed out.
+    const std::vector<map_tile> &tiles() const;
+private:
+    std::vector<map_tile> m_tiles;
+    std::atomic<unsigned int> m_next_tile;
+};
+
+inline tile_scheduler::tile_scheduler(unsigned int xdim, unsigned int ydim, unsigned int tile_width, unsigned int tile_height, unsigned int map_count) : m_next_tile(0)
+{
+    tile_width = std::max(tile_width, 1u);
+    tile_height = std::max(tile_height, 1u);
+    for (unsigned int map_index = 0; map_index < map_count; map_index++) {
+        for (unsigned int y = 0; y < ydim; y += tile_height) {
+            for (unsigned int x = 0; x < xdim; x += tile_width) {
+                m_tiles.push_back(map_tile{x, std::min(x+tile_width, xdim), y, std::min(y+tile_height, ydim), map_index});
+            }
+        }
+    }
+}
+
+template <typename tile_function>
+std::vector<thread_timing> tile_scheduler::run(unsigned int nthreads, tile_function process_tile)
+{
+    thread_pool pool(std::max(nthreads, 1u));
+    return run(pool, process_tile);
+}
+
+template <typename tile_function>
+std::vector<thread_timing> tile_scheduler::run(thread_pool &pool, tile_function process_tile)
+{
+    typedef std::chrono::steady_clock clock_type;
+    const unsigned int nthreads = pool.size();
+    std::vector<thread_timing> timings(nthreads);
+    std::vector<clock_type::time_point> finish_times(nthreads);
+    m_next_tile = 0;
+
+    const clock_type::time_point start = clock_type::now();
+    auto worker = [&](unsigned int thread_index) {
+        thread_timing &timing = timings[thread_index];
+        for (unsigned int tile_index = m_next_tile++; tile_index < m_tiles.size(); tile_index = m_next_tile++) {
+            const clock_type::time_point tile_start = clock_type::now();
+            process_tile(m_tiles[tile_index], thread_index);
+            const std::chrono::duration<double> tile_time = clock_type::now()-tile_start;
+            timing.busy_time += tile_time.count();
+            timing.tile_count++;
+        }
+        finish_times[thread_index] = clock_type::now();
+    };
+
+    pool.run(worker);
+
+    // idle time is everything in the run that a thread did not spend on tiles, mostly waiting on the last tiles of other threads
+    const clock_type::time_point end = *std::max_element(finish_times.begin(), finish_times.end());
+    const std::chrono::duration<double> run_time = end-start;
+    for (auto &timing : timings) {
+        timing.idle_time = std::max(0.0, run_time.count()-timing.busy_time);
+    }
+    return timings;
+}
+
+inline const std::vector<map_tile> &tile_scheduler::tiles() const
+{
+    return m_tiles;
+}
+
+#endif // TILE_SCHEDULER_H